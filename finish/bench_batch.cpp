@@ -0,0 +1,69 @@
+// 批量提交的吞吐 / 延迟测试：多个生产者线程同时提交很小的任务
+// 编译：g++ -std=c++17 -O2 -pthread bench_batch.cpp -o bench_batch
+// 运行：./bench_batch [生产者线程数] [每个生产者提交的任务数] [工作线程数] [maxDelay us]
+#include "threadpool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv)
+{
+    int producers = argc > 1 ? std::atoi(argv[1]) : 16;
+    int perProducer = argc > 2 ? std::atoi(argv[2]) : 20000;
+    int workers = argc > 3 ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+    int maxDelayUs = argc > 4 ? std::atoi(argv[4]) : SUBMIT_MAX_DELAY;
+    int total = producers * perProducer;
+
+    int batches[] = {1, 4, 16, 64, 256};
+
+    std::cout << std::left << std::setw(8) << "batch"
+              << std::setw(14) << "tasks/s" << std::setw(12) << "p50(ns)"
+              << std::setw(12) << "p99(ns)" << "max(ns)" << std::endl;
+
+    for(int batch : batches)
+    {
+        // 每个任务记录从提交到开始执行的延迟
+        std::vector<long long> latency(total);
+        std::atomic_int done(0);
+        double seconds = 0;
+        {
+            ThreadPool pool;
+            pool.setTaskQueThreshHold(total);
+            pool.setSubmitBatch(batch, std::chrono::microseconds(maxDelayUs));
+            pool.start(workers);
+
+            auto begin = Clock::now();
+            std::vector<std::thread> threads;
+            for(int p = 0; p < producers; p++){
+                threads.emplace_back([&, p]() {
+                    for(int i = 0; i < perProducer; i++){
+                        int index = p * perProducer + i;
+                        auto submitTime = Clock::now();
+                        pool.submitTask([&latency, &done, index, submitTime]() {
+                            latency[index] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - submitTime).count();
+                            done++;
+                        });
+                    }
+                    pool.flush();
+                });
+            }
+            for(auto& t : threads){
+                t.join();
+            }
+            while(done < total){
+                std::this_thread::yield();
+            }
+            seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        }
+
+        std::sort(latency.begin(), latency.end());
+        std::cout << std::left << std::setw(8) << batch
+                  << std::setw(14) << std::fixed << std::setprecision(0) << total / seconds
+                  << std::setw(12) << latency[latency.size() / 2]
+                  << std::setw(12) << latency[latency.size() * 99 / 100]
+                  << latency.back() << std::endl;
+    }
+    return 0;
+}
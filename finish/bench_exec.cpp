@@ -0,0 +1,95 @@
+// 根目录线程池（../threadpool.cpp）执行任务的开销测试：Task::exec 里接住异常的 try/catch 在不抛异常时的代价
+// 编译：g++ -std=c++17 -O2 -pthread bench_exec.cpp ../threadpool.cpp -o bench_exec
+// 运行：./bench_exec [每轮的任务数] [轮数]
+#include "../threadpool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+using Clock = std::chrono::steady_clock;
+
+class AddTask : public Task
+{
+public:
+  AddTask(int a, int b):a_(a), b_(b){}
+  Any run() { return a_ + b_; }
+private:
+  int a_;
+  int b_;
+};
+
+class ThrowTask : public Task
+{
+public:
+  Any run() { throw std::runtime_error("bench"); }
+};
+
+// 在当前线程直接调用 exec，只测 exec 本身（含 Result::setValue），单位：ns/任务
+double execOnly(int tasks)
+{
+    auto task = std::make_shared<AddTask>(1, 2);
+    Result res(task);
+    auto begin = Clock::now();
+    for(int i = 0; i < tasks; i++){
+        task->exec();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / tasks;
+}
+
+// 提交到线程池再 get，测整条路径，单位：ns/任务。
+// Task 里保存的是 Result 的裸指针，Result 不能挪动，所以一次只有一个任务在跑
+double submitGet(ThreadPool& pool, int tasks)
+{
+    auto begin = Clock::now();
+    for(int i = 0; i < tasks; i++){
+        Result res = pool.submitTask(std::make_shared<AddTask>(i, 1));
+        res.get();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / tasks;
+}
+
+// 每个任务都抛异常，异常存进 Result，get 时重新抛出
+double submitThrow(ThreadPool& pool, int tasks)
+{
+    auto begin = Clock::now();
+    for(int i = 0; i < tasks; i++){
+        Result res = pool.submitTask(std::make_shared<ThrowTask>());
+        try {
+            res.get();
+        }
+        catch(const std::runtime_error&) {}
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / tasks;
+}
+
+double median(std::vector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+int main(int argc, char** argv)
+{
+    int tasks = argc > 1 ? std::atoi(argv[1]) : 200000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 7;
+
+    std::vector<double> exec, pooled, thrown;
+    {
+        ThreadPool pool;
+        pool.start(2);
+        for(int r = 0; r < rounds; r++){
+            exec.push_back(execOnly(tasks));
+            pooled.push_back(submitGet(pool, tasks / 10));
+            thrown.push_back(submitThrow(pool, tasks / 10));
+        }
+    }
+
+    std::cout << std::left << std::setw(16) << "case" << "median(ns/task) of " << rounds << " rounds" << std::endl
+              << std::fixed << std::setprecision(1)
+              << std::setw(16) << "exec" << median(exec) << std::endl
+              << std::setw(16) << "submit+get" << median(pooled) << std::endl
+              << std::setw(16) << "submit+throw" << median(thrown) << std::endl;
+    return 0;
+}
@@ -0,0 +1,67 @@
+// 空闲等待策略的唤醒延迟测试
+// 编译：g++ -std=c++17 -O2 -pthread bench_idle.cpp -o bench_idle
+// 运行：./bench_idle [采样次数] [两次提交之间的间隔us]
+#include "threadpool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+
+using Clock = std::chrono::steady_clock;
+
+struct Case
+{
+    const char* name;
+    IdleStrategy strategy;
+};
+
+int main(int argc, char** argv)
+{
+    int samples = argc > 1 ? std::atoi(argv[1]) : 2000;
+    int gapUs = argc > 2 ? std::atoi(argv[2]) : 200;
+
+    Case cases[] = {
+        {"park", IdleStrategy::IDLE_PARK},
+        {"busy-spin", IdleStrategy::IDLE_BUSY_SPIN},
+        {"spin-yield", IdleStrategy::IDLE_SPIN_YIELD},
+        {"spin-park", IdleStrategy::IDLE_SPIN_PARK},
+    };
+
+    std::cout << std::left << std::setw(12) << "strategy"
+              << std::setw(12) << "p50(ns)" << std::setw(12) << "p99(ns)"
+              << std::setw(12) << "max(ns)" << "cpu/wall" << std::endl;
+
+    for(const Case& c : cases)
+    {
+        std::vector<long long> latency;
+        latency.reserve(samples);
+        double cpuRatio = 0;
+        {
+            ThreadPool pool;
+            pool.setIdleStrategy(c.strategy);
+            pool.start(1);
+
+            std::clock_t cpuBegin = std::clock();
+            auto wallBegin = Clock::now();
+            for(int i = 0; i < samples; i++){
+                // 等一段时间，让工作线程进入空闲状态，测的是唤醒一个空闲线程的延迟
+                std::this_thread::sleep_for(std::chrono::microseconds(gapUs));
+                auto submitTime = Clock::now();
+                std::future<Clock::time_point> res = pool.submitTask([]() { return Clock::now(); });
+                Clock::time_point startTime = res.get();
+                latency.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(startTime - submitTime).count());
+            }
+            double cpu = double(std::clock() - cpuBegin) / CLOCKS_PER_SEC;
+            double wall = std::chrono::duration<double>(Clock::now() - wallBegin).count();
+            cpuRatio = cpu / wall;
+        }
+
+        std::sort(latency.begin(), latency.end());
+        std::cout << std::left << std::setw(12) << c.name
+                  << std::setw(12) << latency[latency.size() / 2]
+                  << std::setw(12) << latency[latency.size() * 99 / 100]
+                  << std::setw(12) << latency.back()
+                  << std::fixed << std::setprecision(2) << cpuRatio << std::endl;
+    }
+    return 0;
+}
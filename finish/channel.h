@@ -0,0 +1,152 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// 把容量向上取整到2的幂，这样下标可以用 & mask_ 计算
+inline std::size_t roundUpPow2(std::size_t n)
+{
+    std::size_t cap = 1;
+    while(cap < n) cap <<= 1;
+    return cap;
+}
+
+//////////////
+// 有界无锁队列：单生产者 单消费者
+// "单"指同一时刻只有一个，生产者/消费者可以在不同线程之间交接，只要交接本身有同步
+template <typename T>
+class SpscChannel
+{
+public:
+  explicit SpscChannel(std::size_t capacity)
+    : mask_(roundUpPow2(capacity) - 1),
+      buffer_(std::make_unique<T[]>(mask_ + 1)),
+      head_(0),
+      tail_(0)
+  {}
+  SpscChannel(const SpscChannel&) = delete;
+  SpscChannel& operator=(const SpscChannel&) = delete;
+
+  bool tryPush(T&& value)
+  {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if(tail - head_.load(std::memory_order_acquire) > mask_){
+        return false;  // 队列满
+    }
+    buffer_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryPop(T& value)
+  {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    if(head == tail_.load(std::memory_order_acquire)){
+        return false;  // 队列空
+    }
+    value = std::move(buffer_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const
+  {
+    return head_.load() == tail_.load();
+  }
+
+private:
+  const std::size_t mask_;
+  std::unique_ptr<T[]> buffer_;
+  alignas(64) std::atomic<std::size_t> head_;  // 消费者写
+  alignas(64) std::atomic<std::size_t> tail_;  // 生产者写
+};
+
+//////////////
+// 有界无锁队列：多生产者 多消费者（Vyukov的环形队列，每个槽位带一个序号）
+template <typename T>
+class MpmcChannel
+{
+public:
+  explicit MpmcChannel(std::size_t capacity)
+    : mask_(roundUpPow2(capacity) - 1),
+      cells_(std::make_unique<Cell[]>(mask_ + 1)),
+      enqueuePos_(0),
+      dequeuePos_(0)
+  {
+    for(std::size_t i = 0; i <= mask_; i++){
+        cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  MpmcChannel(const MpmcChannel&) = delete;
+  MpmcChannel& operator=(const MpmcChannel&) = delete;
+
+  bool tryPush(T&& value)
+  {
+    std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    for(;;){
+        Cell& cell = cells_[pos & mask_];
+        std::size_t seq = cell.seq.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+        if(diff == 0){
+            // 槽位空闲，抢占它
+            if(enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                cell.data = std::move(value);
+                cell.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if(diff < 0){
+            return false;  // 队列满
+        }
+        else {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+  }
+
+  bool tryPop(T& value)
+  {
+    std::size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    for(;;){
+        Cell& cell = cells_[pos & mask_];
+        std::size_t seq = cell.seq.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+        if(diff == 0){
+            if(dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                value = std::move(cell.data);
+                cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if(diff < 0){
+            return false;  // 队列空
+        }
+        else {
+            pos = dequeuePos_.load(std::memory_order_relaxed);
+        }
+    }
+  }
+
+  // 近似值：有生产者占了槽位但还没写完时，也算作非空
+  bool empty() const
+  {
+    return dequeuePos_.load() == enqueuePos_.load();
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<std::size_t> seq;
+    T data;
+  };
+
+  const std::size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  alignas(64) std::atomic<std::size_t> enqueuePos_;
+  alignas(64) std::atomic<std::size_t> dequeuePos_;
+};
+
+#endif
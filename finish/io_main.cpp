@@ -0,0 +1,91 @@
+// IoService 的测试程序：普通文件读写、管道读、析构时取消，io_uring 和 epoll 两种模式都跑一遍
+// 编译：g++ -std=c++17 -O2 -pthread io_main.cpp -o io_main
+// 运行：./io_main   全部通过返回0
+#include "ioservice.h"
+#include <fcntl.h>
+#include <cstdlib>
+#include <string>
+
+const int IO_WAIT_TIMEOUT = 5;  // 等待一个回调的最长时间，单位：秒
+
+// 等待回调的结果，超时返回 -ETIMEDOUT
+ssize_t waitResult(std::future<ssize_t>& res)
+{
+    if(res.wait_for(std::chrono::seconds(IO_WAIT_TIMEOUT)) != std::future_status::ready){
+        return -ETIMEDOUT;
+    }
+    return res.get();
+}
+
+bool check(const char* mode, const char* name, bool ok)
+{
+    std::cout << mode << " " << name << (ok ? " ok" : " fail") << std::endl;
+    return ok;
+}
+
+bool runMode(ThreadPool& pool, bool useIoUring)
+{
+    bool ok = true;
+    std::string path = "/tmp/io_main_" + std::to_string(::getpid());
+    int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    int pipeFds[2];
+    if(fd < 0 || ::pipe(pipeFds) < 0){
+        std::cout << "open file/pipe failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::promise<ssize_t> cancelled;
+    std::future<ssize_t> cancelRes = cancelled.get_future();
+    const char* mode = useIoUring ? "io_uring" : "epoll";
+    {
+        IoService io(pool, 64, useIoUring);
+        if(useIoUring && !io.isIoUring()){
+            mode = "io_uring(fallback epoll)";  // 内核不支持 io_uring
+        }
+
+        // 普通文件：写进去再按偏移读出来
+        const std::string msg = "hello io_uring";
+        std::promise<ssize_t> written;
+        std::future<ssize_t> writeRes = written.get_future();
+        io.asyncWrite(fd, msg.data(), msg.size(), 0, [&](ssize_t n){ written.set_value(n); });
+        ok &= check(mode, "file write", waitResult(writeRes) == static_cast<ssize_t>(msg.size()));
+
+        char buf[32] = {0};
+        std::promise<ssize_t> readDone;
+        std::future<ssize_t> readRes = readDone.get_future();
+        io.asyncRead(fd, buf, sizeof(buf), 6, [&](ssize_t n){ readDone.set_value(n); });
+        ok &= check(mode, "file read", waitResult(readRes) == 8 && std::string(buf) == "io_uring");
+
+        // 管道：先发起读，再往写端写数据，回调要等数据到了才执行
+        char pipeBuf[16] = {0};
+        std::promise<ssize_t> piped;
+        std::future<ssize_t> pipeRes = piped.get_future();
+        io.asyncRead(pipeFds[0], pipeBuf, sizeof(pipeBuf), -1, [&](ssize_t n){ piped.set_value(n); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        bool early = pipeRes.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        ssize_t sent = ::write(pipeFds[1], "pipe", 4);
+        ok &= check(mode, "pipe read", !early && sent == 4 && waitResult(pipeRes) == 4 && std::string(pipeBuf) == "pipe");
+
+        // 管道里没有数据，这个读操作在 io 析构时被取消
+        io.asyncRead(pipeFds[0], pipeBuf, sizeof(pipeBuf), -1, [&](ssize_t n){ cancelled.set_value(n); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ok &= check(mode, "cancel on destruction", waitResult(cancelRes) == -ECANCELED);
+
+    ::close(pipeFds[0]);
+    ::close(pipeFds[1]);
+    ::close(fd);
+    ::unlink(path.c_str());
+    return ok;
+}
+
+int main()
+{
+    ThreadPool pool;
+    pool.start(2);
+
+    bool ok = runMode(pool, true);
+    ok &= runMode(pool, false);
+    std::cout << (ok ? "all passed" : "some checks failed") << std::endl;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
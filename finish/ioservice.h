@@ -0,0 +1,567 @@
+#ifndef IOSERVICE_H
+#define IOSERVICE_H
+
+#include "threadpool.h"
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <system_error>
+
+/*
+异步I/O：读写请求交给 io_uring（内核不支持时退化为 epoll），
+由一个专门的I/O线程收割完成事件，再把回调作为任务提交到线程池。
+这样工作线程不会阻塞在 read()/write() 上。
+
+example:
+ThreadPool pool;
+pool.start(std::thread::hardware_concurrency());
+IoService io(pool);   // io 必须先于 pool 析构
+
+io.asyncRead(fd, buf, len, 0, [](ssize_t n){ // 在线程池里执行 });
+
+注意：
+1. 回调参数 >= 0 表示读写的字节数，< 0 表示 -errno；IoService 析构时未完成的操作回调 -ECANCELED
+2. buf 在回调执行前必须保持有效
+3. offset < 0 表示使用文件的当前偏移（管道、套接字必须这样用）
+4. epoll 模式下普通文件无法监听就绪，作为线程池任务阻塞读写（回调也在这个任务里执行），
+   不占用I/O线程；管道/套接字的写操作建议设置为非阻塞
+5. 线程池队列满的时候回调直接在I/O线程里执行，回调本身不要阻塞太久
+6. 用别的线程池类型时写 BasicIoService<FastPool> io(fastPool);
+*/
+template <typename Pool = ThreadPool>
+class BasicIoService
+{
+public:
+  using Callback = std::function<void(ssize_t)>;
+
+  BasicIoService(Pool& pool, unsigned entries = 256, bool useIoUring = true)
+    : pool_(pool),
+      stop_(false),
+      ringFd_(-1),
+      epollFd_(-1),
+      wakeFd_(-1)
+  {
+    if(!useIoUring || !setupRing(entries)){
+        setupEpoll();
+        ioThread_ = std::thread(&BasicIoService::epollLoop, this);
+    }
+    else {
+        ioThread_ = std::thread(&BasicIoService::ringLoop, this);
+    }
+  }
+
+  ~BasicIoService()
+  {
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        stop_ = true;
+        if(isIoUring()){
+            // 取消所有还在等待的操作，它们的完成事件会唤醒I/O线程
+            for(IoOp* op : pending_){
+                pushSqe(IORING_OP_ASYNC_CANCEL, -1, op, 0, 0, CANCEL_TAG);
+                enterRing();
+            }
+            pushSqe(IORING_OP_NOP, -1, nullptr, 0, 0, WAKE_TAG);
+            enterRing();
+        }
+        else {
+            wakeEpoll();
+        }
+    }
+    ioThread_.join();
+    {
+        // 线程池里还在读写普通文件的操作要等它们结束
+        std::unique_lock<std::mutex> lock(mtx_);
+        fileOpsDone_.wait(lock, [&]()->bool { return fileOps_ == 0; });
+    }
+
+    if(isIoUring()){
+        ::munmap(sqes_, sqesSize_);
+        if(cqRing_ != sqRing_) ::munmap(cqRing_, cqRingSize_);
+        ::munmap(sqRing_, sqRingSize_);
+        ::close(ringFd_);
+    }
+    else {
+        ::close(wakeFd_);
+        ::close(epollFd_);
+    }
+  }
+
+  BasicIoService(const BasicIoService&) = delete;
+  BasicIoService& operator=(const BasicIoService&) = delete;
+
+  void asyncRead(int fd, void* buf, std::size_t len, off_t offset, Callback cb)
+  {
+    submit(new IoOp{true, fd, buf, len, offset, std::move(cb)});
+  }
+
+  void asyncWrite(int fd, const void* buf, std::size_t len, off_t offset, Callback cb)
+  {
+    submit(new IoOp{false, fd, const_cast<void*>(buf), len, offset, std::move(cb)});
+  }
+
+  bool isIoUring() const
+  {
+    return ringFd_ >= 0;
+  }
+
+private:
+  struct IoOp
+  {
+    bool isRead;
+    int fd;
+    void* buf;
+    std::size_t len;
+    off_t offset;
+    Callback cb;
+  };
+
+  // user_data 里的特殊标记，IoOp指针是对齐的，不会和它们冲突
+  static constexpr std::uint64_t WAKE_TAG = 1;
+  static constexpr std::uint64_t CANCEL_TAG = 2;
+
+  void submit(IoOp* op)
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if(stop_){
+        lock.unlock();
+        complete(op, -ECANCELED);
+        return;
+    }
+    if(isIoUring()){
+        // 在途操作不能超过完成队列的容量，否则完成事件会溢出。
+        // I/O线程里（回调直接执行时又发起读写）不能等：只有它自己能腾出位置，先放进 overflow_，收割完再提交
+        if(reaper_ == this){
+            if(pending_.size() >= cqEntries_ || !overflow_.empty()){
+                overflow_.push_back(op);
+                return;
+            }
+        }
+        else {
+            notFull_.wait(lock, [&]()->bool { return pending_.size() < cqEntries_; });
+        }
+        int ret = submitToRing(op);
+        if(ret < 0){
+            lock.unlock();
+            complete(op, ret);
+        }
+    }
+    else {
+        waiting_[op->fd].push_back(op);
+        armFd(op->fd);
+    }
+  }
+
+  // 把I/O完成的回调交给线程池。不能等待也不能丢：线程池队列满了就在当前线程（通常是I/O线程）直接执行
+  void complete(IoOp* op, ssize_t res)
+  {
+    Callback cb = std::move(op->cb);
+    delete op;
+    if(cb && !pool_.trySubmitTask([cb, res](){ cb(res); })){
+        cb(res);
+    }
+  }
+
+  /////////////// io_uring
+  bool setupRing(unsigned entries)
+  {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if(fd < 0){
+        return false;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(singleMmap){
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = ::mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(sqRing_ == MAP_FAILED){
+        ::close(fd);
+        return false;
+    }
+    cqRing_ = sqRing_;
+    if(!singleMmap){
+        cqRing_ = ::mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(cqRing_ == MAP_FAILED){
+            ::munmap(sqRing_, sqRingSize_);
+            ::close(fd);
+            return false;
+        }
+    }
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED){
+        if(!singleMmap) ::munmap(cqRing_, cqRingSize_);
+        ::munmap(sqRing_, sqRingSize_);
+        ::close(fd);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sqRing_);
+    char* cq = static_cast<char*>(cqRing_);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+    cqEntries_ = params.cq_entries;
+    ringFd_ = fd;
+    return true;
+  }
+
+  // 把读写请求交给内核，失败时返回 -errno，调用者持有 mtx_
+  int submitToRing(IoOp* op)
+  {
+    pushSqe(op->isRead ? IORING_OP_READ : IORING_OP_WRITE,
+            op->fd, op->buf, op->len, op->offset, reinterpret_cast<std::uint64_t>(op));
+    int ret = enterRing();
+    if(ret < 0){
+        // 内核没有取走这个请求，撤回它
+        __atomic_store_n(sqTail_, *sqTail_ - 1, __ATOMIC_RELEASE);
+        return ret;
+    }
+    pending_.insert(op);
+    return 0;
+  }
+
+  // 往提交队列里放一个请求，调用者持有 mtx_
+  void pushSqe(int opcode, int fd, void* buf, std::size_t len, off_t offset, std::uint64_t userData)
+  {
+    unsigned tail = *sqTail_;
+    unsigned index = tail & sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = static_cast<std::uint8_t>(opcode);
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(buf);
+    sqe->len = static_cast<std::uint32_t>(len);
+    sqe->off = offset < 0 ? static_cast<std::uint64_t>(-1) : static_cast<std::uint64_t>(offset);
+    sqe->user_data = userData;
+    sqArray_[index] = index;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  // 把提交队列里的请求交给内核，调用者持有 mtx_
+  int enterRing()
+  {
+    for(;;){
+        int ret = static_cast<int>(::syscall(__NR_io_uring_enter, ringFd_, 1, 0, 0, nullptr, 0));
+        if(ret >= 0) return 0;
+        if(errno != EINTR) return -errno;
+    }
+  }
+
+  void ringLoop()
+  {
+    reaper_ = this;
+    for(;;)
+    {
+        int ret = static_cast<int>(::syscall(__NR_io_uring_enter, ringFd_, 0, 1,
+                                             IORING_ENTER_GETEVENTS, nullptr, 0));
+        if(ret < 0 && errno != EINTR){
+            // 收割失败，稍后重试，不能丢弃在途的请求
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        std::vector<std::pair<IoOp*, ssize_t>> done;
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++){
+            io_uring_cqe* cqe = &cqes_[head & cqMask_];
+            if(cqe->user_data == WAKE_TAG || cqe->user_data == CANCEL_TAG){
+                continue;
+            }
+            done.emplace_back(reinterpret_cast<IoOp*>(cqe->user_data), cqe->res);
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+        bool exit = false;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            for(auto& item : done){
+                pending_.erase(item.first);
+            }
+            // 回调里发起的请求，有位置了就提交；要结束了就取消
+            while(!overflow_.empty() && (stop_ || pending_.size() < cqEntries_)){
+                IoOp* op = overflow_.front();
+                overflow_.pop_front();
+                int ret = stop_ ? -ECANCELED : submitToRing(op);
+                if(ret < 0){
+                    done.emplace_back(op, ret);
+                }
+            }
+            notFull_.notify_all();
+            exit = stop_ && pending_.empty();
+        }
+
+        for(auto& item : done){
+            complete(item.first, item.second);
+        }
+        if(exit){
+            return;
+        }
+    }
+  }
+
+  /////////////// epoll
+  void setupEpoll()
+  {
+    epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(epollFd_ < 0 || wakeFd_ < 0){
+        throw std::system_error(errno, std::generic_category(), "IoService epoll setup failed");
+    }
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd_;
+    ::epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+  }
+
+  void wakeEpoll()
+  {
+    std::uint64_t one = 1;
+    ssize_t n = ::write(wakeFd_, &one, sizeof(one));
+    (void)n;
+  }
+
+  // 根据 fd 上等待的操作重新注册事件，调用者持有 mtx_
+  void armFd(int fd)
+  {
+    std::deque<IoOp*>& ops = waiting_[fd];
+    if(ops.empty()){
+        waiting_.erase(fd);
+        return;
+    }
+
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLONESHOT;
+    for(IoOp* op : ops){
+        ev.events |= op->isRead ? EPOLLIN : EPOLLOUT;
+    }
+    ev.data.fd = fd;
+
+    int ret = -1;
+    if(registered_.count(fd) > 0){
+        ret = ::epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+    }
+    if(ret < 0){
+        // fd 被关闭后 epoll 会自动移除它，此时需要重新添加
+        ret = ::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if(ret == 0){
+        registered_.insert(fd);
+        return;
+    }
+
+    // 普通文件不支持 epoll（EPERM），总是就绪，交给I/O线程直接读写
+    int err = errno;
+    registered_.erase(fd);
+    for(IoOp* op : ops){
+        if(err == EPERM){
+            ready_.push_back(op);
+        }
+        else {
+            failed_.emplace_back(op, -err);
+        }
+    }
+    waiting_.erase(fd);
+    wakeEpoll();
+  }
+
+  ssize_t doIo(IoOp* op)
+  {
+    ssize_t n;
+    if(op->isRead){
+        n = op->offset < 0 ? ::read(op->fd, op->buf, op->len)
+                           : ::pread(op->fd, op->buf, op->len, op->offset);
+    }
+    else {
+        n = op->offset < 0 ? ::write(op->fd, op->buf, op->len)
+                           : ::pwrite(op->fd, op->buf, op->len, op->offset);
+    }
+    return n < 0 ? -errno : n;
+  }
+
+  // 在线程池里阻塞地读写普通文件，回调直接在这个任务里执行。线程池队列满了返回 false
+  bool runFileOp(IoOp* op)
+  {
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        fileOps_++;
+    }
+    bool queued = pool_.trySubmitTask([this, op](){
+        ssize_t res = doIo(op);
+        Callback cb = std::move(op->cb);
+        delete op;
+        if(cb){
+            cb(res);
+        }
+        finishFileOp();
+    });
+    if(!queued){
+        finishFileOp();
+    }
+    return queued;
+  }
+
+  void finishFileOp()
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if(--fileOps_ == 0){
+        fileOpsDone_.notify_all();
+    }
+  }
+
+  void epollLoop()
+  {
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+    for(;;)
+    {
+        int n = ::epoll_wait(epollFd_, events, MAX_EVENTS, -1);
+        if(n < 0 && errno != EINTR){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        std::vector<IoOp*> runnable;
+        std::vector<IoOp*> fileOps;
+        std::vector<std::pair<IoOp*, ssize_t>> done;
+        bool exit = false;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            for(int i = 0; i < n; i++){
+                int fd = events[i].data.fd;
+                if(fd == wakeFd_){
+                    std::uint64_t value;
+                    ssize_t r = ::read(wakeFd_, &value, sizeof(value));
+                    (void)r;
+                    continue;
+                }
+                // 每个就绪的方向取出一个等待的操作，其余的重新注册
+                auto it = waiting_.find(fd);
+                if(it == waiting_.end()){
+                    continue;
+                }
+                bool readTaken = false, writeTaken = false;
+                std::deque<IoOp*>& ops = it->second;
+                for(auto opIt = ops.begin(); opIt != ops.end();){
+                    IoOp* op = *opIt;
+                    bool ready = op->isRead ? (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !readTaken
+                                            : (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && !writeTaken;
+                    if(ready){
+                        (op->isRead ? readTaken : writeTaken) = true;
+                        runnable.push_back(op);
+                        opIt = ops.erase(opIt);
+                    }
+                    else {
+                        ++opIt;
+                    }
+                }
+                armFd(fd);
+            }
+            fileOps.swap(ready_);
+            done.swap(failed_);
+
+            if(stop_){
+                for(auto& item : waiting_){
+                    for(IoOp* op : item.second){
+                        done.emplace_back(op, -ECANCELED);
+                    }
+                }
+                waiting_.clear();
+                exit = true;
+            }
+        }
+
+        // 普通文件的读写会阻塞，交给线程池执行，I/O线程只负责管道/套接字的就绪事件
+        for(IoOp* op : fileOps){
+            if(!runFileOp(op)){
+                runnable.push_back(op);  // 线程池队列满了，只好在I/O线程里执行
+            }
+        }
+
+        // 在锁外执行真正的读写
+        for(IoOp* op : runnable){
+            ssize_t res = doIo(op);
+            if(res == -EAGAIN && !exit){
+                std::unique_lock<std::mutex> lock(mtx_);
+                waiting_[op->fd].push_front(op);
+                armFd(op->fd);
+                continue;
+            }
+            done.emplace_back(op, res == -EAGAIN ? -ECANCELED : res);
+        }
+        for(auto& item : done){
+            complete(item.first, item.second);
+        }
+        if(exit){
+            return;
+        }
+    }
+  }
+
+private:
+  Pool& pool_;
+  std::thread ioThread_;  // I/O线程，只负责收割完成事件
+  std::mutex mtx_;
+  std::condition_variable notFull_; // 表示在途请求没有超过完成队列容量
+  bool stop_;
+
+  // io_uring
+  int ringFd_;
+  void* sqRing_ = nullptr;
+  void* cqRing_ = nullptr;
+  std::size_t sqRingSize_ = 0;
+  std::size_t cqRingSize_ = 0;
+  std::size_t sqesSize_ = 0;
+  unsigned* sqTail_ = nullptr;
+  unsigned sqMask_ = 0;
+  unsigned* sqArray_ = nullptr;
+  unsigned* cqHead_ = nullptr;
+  unsigned* cqTail_ = nullptr;
+  unsigned cqMask_ = 0;
+  unsigned cqEntries_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+  io_uring_sqe* sqes_ = nullptr;
+  std::unordered_set<IoOp*> pending_;  // 已经交给内核还没完成的请求
+  std::deque<IoOp*> overflow_;  // I/O线程在回调里发起、完成队列满了暂时没提交的请求
+  inline static thread_local BasicIoService* reaper_ = nullptr;  // 当前线程是哪个 IoService 的I/O线程
+
+  // epoll
+  int epollFd_;
+  int wakeFd_;  // eventfd，用于唤醒I/O线程
+  std::unordered_map<int, std::deque<IoOp*>> waiting_;  // fd => 等待就绪的请求
+  std::unordered_set<int> registered_;  // 已经加入 epoll 的 fd
+  std::vector<IoOp*> ready_;  // 可以直接读写的请求（普通文件），由I/O线程交给线程池
+  std::size_t fileOps_ = 0;  // 线程池里正在读写普通文件的操作数
+  std::condition_variable fileOpsDone_;
+  std::vector<std::pair<IoOp*, ssize_t>> failed_;  // 注册失败的请求
+};
+
+using IoService = BasicIoService<>;
+
+#endif
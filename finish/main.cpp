@@ -24,6 +24,7 @@ int main()
     for(int i = b;i <= e;i++){
         sum += i;
     }
+    return sum;
    }, 1, 100);
 
    std::cout << res1.get() << std::endl;
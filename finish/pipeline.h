@@ -0,0 +1,343 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "threadpool.h"
+#include "channel.h"
+#include <any>
+#include <map>
+#include <optional>
+#include <exception>
+
+/*
+流水线：source -> stage -> ... -> sink，每一级都作为线程池任务运行
+1. 每一级可以是串行（同一时刻只有一个任务在处理）或并行（最多 parallelism 个任务同时处理）
+2. 相邻两级之间用有界无锁队列连接：两端都是串行时用 SpscChannel，否则用 MpmcChannel
+3. SERIAL_IN_ORDER 的级按 source 产生数据的顺序处理，用来得到保序的输出
+4. 令牌数 maxTokens 限制同时在流水线里的数据个数，内存占用有上界（和TBB的 parallel_pipeline 一样）
+
+example:
+ThreadPool pool;
+pool.start(4);
+
+Pipeline pipe(pool, 16);
+int n = 0;
+pipe.source<int>([&]() -> std::optional<int> { if(n == 100) return std::nullopt; return n++; })
+    .stage<int, std::string>(StageMode::PARALLEL, [](int x){ return std::to_string(x * x); }, 4)
+    .sink<std::string>(StageMode::SERIAL_IN_ORDER, [](std::string s){ std::cout << s << std::endl; });
+pipe.run();  // 阻塞直到所有数据流过 sink，stage 里的异常会在这里重新抛出
+
+注意：
+1. run() 不能在同一个线程池的工作线程里调用，否则可能没有线程来运行流水线
+2. 数据在级之间用 std::any 保存，类型需要可以拷贝构造
+3. 用别的线程池类型时写 BasicPipeline<FastPool> pipe(fastPool, 16);
+*/
+enum class StageMode
+{
+    SERIAL_IN_ORDER,  // 串行，按顺序
+    SERIAL_OUT_OF_ORDER,  // 串行，不保证顺序
+    PARALLEL,  // 并行
+};
+
+template <typename Pool = ThreadPool>
+class BasicPipeline
+{
+public:
+  BasicPipeline(Pool& pool, std::size_t maxTokens)
+    : pool_(pool),
+      maxTokens_(maxTokens > 0 ? maxTokens : 1),
+      tokens_(0),
+      nextSeq_(0),
+      sourceDone_(false),
+      sourceActive_(false),
+      runningTasks_(0),
+      finished_(false)
+  {}
+  BasicPipeline(const BasicPipeline&) = delete;
+  BasicPipeline& operator=(const BasicPipeline&) = delete;
+
+  // 数据源：每次调用返回一个数据，返回 std::nullopt 表示结束。source 总是串行调用的
+  template <typename Out, typename Fun>
+  BasicPipeline& source(Fun&& func)
+  {
+    source_ = [func = std::forward<Fun>(func)]() mutable -> std::optional<std::any> {
+        std::optional<Out> out = func();
+        if(!out) return std::nullopt;
+        return std::any(std::move(*out));
+    };
+    return *this;
+  }
+
+  // 中间级：Out func(In)
+  template <typename In, typename Out, typename Fun>
+  BasicPipeline& stage(StageMode mode, Fun&& func, std::size_t parallelism = 1)
+  {
+    addStage(mode, parallelism, [func = std::forward<Fun>(func)](std::any& value) mutable {
+        value = std::any(func(std::any_cast<In>(std::move(value))));
+    });
+    return *this;
+  }
+
+  // 最后一级：void func(In)
+  template <typename In, typename Fun>
+  BasicPipeline& sink(StageMode mode, Fun&& func, std::size_t parallelism = 1)
+  {
+    addStage(mode, parallelism, [func = std::forward<Fun>(func)](std::any& value) mutable {
+        func(std::any_cast<In>(std::move(value)));
+        value.reset();
+    });
+    return *this;
+  }
+
+  void run()
+  {
+    tokens_ = maxTokens_;
+    nextSeq_ = 0;
+    sourceDone_ = !source_;
+    error_ = nullptr;
+    finished_ = false;
+    for(auto& st : stages_){
+        st->nextSeq = 0;
+        st->reorder.clear();
+    }
+    if(sourceDone_){
+        return;
+    }
+
+    sourceActive_ = true;
+    spawn([this](){ runSource(); });
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    doneCond_.wait(lock, [&]()->bool { return finished_; });
+    if(error_){
+        std::rethrow_exception(error_);
+    }
+  }
+
+private:
+  // 流水线里流动的数据，seq 是 source 产生它的顺序
+  struct Item
+  {
+    std::size_t seq = 0;
+    std::any value;
+    bool failed = false;  // 前面某一级抛了异常，后面的级只负责把它传下去
+  };
+
+  struct Stage
+  {
+    StageMode mode;
+    std::size_t parallelism;
+    std::function<void(std::any&)> func;
+    std::unique_ptr<SpscChannel<Item>> spsc;  // 输入队列，两个里面只有一个不为空
+    std::unique_ptr<MpmcChannel<Item>> mpmc;
+    std::atomic<std::size_t> active{0};  // 正在处理这一级的任务数
+    std::map<std::size_t, Item> reorder;  // SERIAL_IN_ORDER 用来等待前面的数据
+    std::size_t nextSeq = 0;
+
+    bool isSerial() const { return mode != StageMode::PARALLEL; }
+    bool tryPush(Item&& item) { return spsc ? spsc->tryPush(std::move(item)) : mpmc->tryPush(std::move(item)); }
+    bool tryPop(Item& item) { return spsc ? spsc->tryPop(item) : mpmc->tryPop(item); }
+    bool empty() const { return spsc ? spsc->empty() : mpmc->empty(); }
+  };
+
+  void addStage(StageMode mode, std::size_t parallelism, std::function<void(std::any&)> func)
+  {
+    auto st = std::make_unique<Stage>();
+    st->mode = mode;
+    st->parallelism = (mode == StageMode::PARALLEL && parallelism > 0) ? parallelism : 1;
+    st->func = std::move(func);
+
+    // 令牌保证同时存在的数据不超过 maxTokens_，所以队列永远不会满
+    bool upstreamSerial = stages_.empty() || stages_.back()->isSerial();
+    if(upstreamSerial && st->isSerial()){
+        st->spsc = std::make_unique<SpscChannel<Item>>(maxTokens_);
+    }
+    else {
+        st->mpmc = std::make_unique<MpmcChannel<Item>>(maxTokens_);
+    }
+    stages_.emplace_back(std::move(st));
+  }
+
+  // 所有流水线任务都通过这里提交，最后一个任务退出时流水线结束。
+  // 线程池队列满了就在当前线程直接执行：runningTasks_ 已经加过了，任务丢掉的话 run() 会一直等下去。
+  // 同一时刻只有一个 source 任务，所以直接执行时嵌套的深度不会超过级数的两倍
+  template <typename Fun>
+  void spawn(Fun&& func)
+  {
+    runningTasks_++;
+    auto task = [this, func = std::forward<Fun>(func)]() mutable {
+        func();
+        if(runningTasks_.fetch_sub(1) == 1){
+            std::unique_lock<std::mutex> lock(mtx_);
+            finished_ = true;
+            doneCond_.notify_all();
+        }
+    };
+    if(!pool_.trySubmitTask(task)){
+        task();
+    }
+  }
+
+  void runSource()
+  {
+    for(;;)
+    {
+        while(!sourceDone_ && takeToken()){
+            std::optional<std::any> out;
+            try {
+                out = source_();
+            }
+            catch(...) {
+                setError(std::current_exception());
+            }
+            if(!out){
+                sourceDone_ = true;
+                tokens_++;
+                break;
+            }
+            Item item;
+            item.seq = nextSeq_++;
+            item.value = std::move(*out);
+            pushTo(0, std::move(item));
+        }
+
+        sourceActive_ = false;
+        // 释放令牌的一方可能刚好看到 sourceActive_ 为 true 而没有调度，这里再检查一次
+        if(sourceDone_ || tokens_ == 0 || sourceActive_.exchange(true)){
+            return;
+        }
+    }
+  }
+
+  bool takeToken()
+  {
+    std::size_t cur = tokens_.load();
+    while(cur > 0){
+        if(tokens_.compare_exchange_weak(cur, cur - 1)){
+            return true;
+        }
+    }
+    return false;
+  }
+
+  // 数据离开最后一级，归还令牌，必要时重新调度 source
+  void releaseToken()
+  {
+    tokens_++;
+    if(!sourceDone_ && !sourceActive_.exchange(true)){
+        spawn([this](){ runSource(); });
+    }
+  }
+
+  void pushTo(std::size_t index, Item&& item)
+  {
+    if(index == stages_.size()){
+        releaseToken();
+        return;
+    }
+    Stage& st = *stages_[index];
+    while(!st.tryPush(std::move(item))){
+        std::this_thread::yield();  // 有令牌限制，正常不会走到这里
+    }
+    // 和 drain 退出时的 active-- 再检查队列 配对：先放数据再看 active，对方先减 active 再看队列。
+    // 队列只用了 release/relaxed，两边都要全屏障，否则可能双方都没看到对方，最后一个数据没人处理
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    schedule(index);
+  }
+
+  // 这一级的并发任务数还没到上限，就再提交一个任务
+  bool acquire(Stage& st)
+  {
+    std::size_t cur = st.active.load();
+    while(cur < st.parallelism){
+        if(st.active.compare_exchange_weak(cur, cur + 1)){
+            return true;
+        }
+    }
+    return false;
+  }
+
+  void schedule(std::size_t index)
+  {
+    if(acquire(*stages_[index])){
+        spawn([this, index](){ drain(index); });
+    }
+  }
+
+  void process(Stage& st, Item& item)
+  {
+    if(item.failed){
+        return;
+    }
+    try {
+        st.func(item.value);
+    }
+    catch(...) {
+        item.failed = true;
+        item.value.reset();
+        setError(std::current_exception());
+    }
+  }
+
+  void drain(std::size_t index)
+  {
+    Stage& st = *stages_[index];
+    for(;;)
+    {
+        Item item;
+        while(st.tryPop(item)){
+            if(st.mode != StageMode::SERIAL_IN_ORDER){
+                process(st, item);
+                pushTo(index + 1, std::move(item));
+                continue;
+            }
+            // 保序：先放进重排缓冲，把已经连续的数据依次处理掉
+            st.reorder.emplace(item.seq, std::move(item));
+            while(!st.reorder.empty() && st.reorder.begin()->first == st.nextSeq){
+                Item next = std::move(st.reorder.begin()->second);
+                st.reorder.erase(st.reorder.begin());
+                st.nextSeq++;
+                process(st, next);
+                pushTo(index + 1, std::move(next));
+            }
+        }
+
+        st.active--;
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // 见 pushTo
+        // 退出前如果又有数据进来，并且生产者没有调度新任务，就由自己继续处理
+        if(st.empty() || !acquire(st)){
+            return;
+        }
+    }
+  }
+
+  // 记录第一个异常，并让 source 停止产生新数据
+  void setError(std::exception_ptr e)
+  {
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if(!error_) error_ = e;
+    }
+    sourceDone_ = true;
+  }
+
+private:
+  Pool& pool_;
+  const std::size_t maxTokens_;  // 同时在流水线里的数据个数上限
+  std::function<std::optional<std::any>()> source_;
+  std::vector<std::unique_ptr<Stage>> stages_;
+
+  std::atomic<std::size_t> tokens_;  // 剩余令牌
+  std::size_t nextSeq_;  // 只有 source 任务访问
+  std::atomic_bool sourceDone_;
+  std::atomic_bool sourceActive_;  // source 任务是否已经提交/正在运行
+  std::atomic<std::size_t> runningTasks_;  // 已提交还没结束的流水线任务
+
+  std::mutex mtx_;
+  std::condition_variable doneCond_;  // 等待流水线结束
+  bool finished_;
+  std::exception_ptr error_;
+};
+
+using Pipeline = BasicPipeline<>;
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "channel.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+BasicThreadPool 的编译期策略，每一类策略都是一个小类，线程池把它当成员直接调用，
+编译期确定的值（比如 FixedMode::isCached()）会被内联成常量，对应的分支也就被编译器去掉了
+
+1. 队列策略    MutexQueue（默认）  LockFreeQueue  WorkStealingQueue
+2. 空闲策略    RuntimeIdle（默认，运行时 setIdleStrategy）  ParkIdle  BusySpinIdle  SpinYieldIdle  SpinParkIdle
+3. 任务存储    std::function<void()>（默认）  UniqueTask
+4. 统计策略    NoStats（默认）  CountingStats（另外记录每个工作线程在执行什么，dumpState 和看门狗要用）
+5. 模式策略    RuntimeMode（默认，运行时 setMode）  FixedMode  CachedMode
+*/
+
+const int IDLE_SPIN_COUNT = 4096;  // 空闲时自旋检查队列的次数
+const int IDLE_MAX_BACKOFF = 64;  // 自旋退避时每次最多 pause 的次数
+
+enum class PoolMode
+{
+    MODE_FIXED,  // 数量固定
+    MODE_CACHED,  // 动态变化
+};
+
+// 工作线程没有任务时怎么等待：用CPU换唤醒延迟
+enum class IdleStrategy
+{
+    IDLE_PARK,  // 直接在条件变量上睡眠（默认），不占CPU，唤醒最慢
+    IDLE_BUSY_SPIN,  // 一直自旋，唤醒最快，一直占满一个核
+    IDLE_SPIN_YIELD,  // 先自旋，再不停地 yield 让出CPU
+    IDLE_SPIN_PARK,  // 先自旋（指数退避），还没有任务就去条件变量上睡眠
+};
+
+// 自旋等待时提示CPU，降低功耗，也让出超线程的执行资源
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+//////////////
+// 模式策略
+class RuntimeMode
+{
+public:
+  RuntimeMode():mode_(PoolMode::MODE_FIXED){}
+  void set(PoolMode mode) { mode_ = mode; }
+  bool isCached() const { return mode_ == PoolMode::MODE_CACHED; }
+private:
+  PoolMode mode_;
+};
+
+template <PoolMode Mode>
+class StaticMode
+{
+public:
+  void set(PoolMode) {}  // 编译期已经确定，setMode 不起作用
+  constexpr bool isCached() const { return Mode == PoolMode::MODE_CACHED; }
+};
+
+using FixedMode = StaticMode<PoolMode::MODE_FIXED>;
+using CachedMode = StaticMode<PoolMode::MODE_CACHED>;
+
+//////////////
+// 空闲策略
+class RuntimeIdle
+{
+public:
+  RuntimeIdle()
+    : strategy_(IdleStrategy::IDLE_PARK),
+      spinCount_(IDLE_SPIN_COUNT),
+      maxBackoff_(IDLE_MAX_BACKOFF)
+  {}
+  void set(IdleStrategy strategy, int spinCount, int maxBackoff)
+  {
+    strategy_ = strategy;
+    spinCount_ = spinCount;
+    maxBackoff_ = maxBackoff > 0 ? maxBackoff : 1;
+  }
+  IdleStrategy strategy() const { return strategy_; }
+  int spinCount() const { return spinCount_; }
+  int maxBackoff() const { return maxBackoff_; }
+private:
+  IdleStrategy strategy_;
+  int spinCount_;
+  int maxBackoff_;
+};
+
+template <IdleStrategy Strategy, int SpinCount = IDLE_SPIN_COUNT, int MaxBackoff = IDLE_MAX_BACKOFF>
+class StaticIdle
+{
+public:
+  void set(IdleStrategy, int, int) {}  // 编译期已经确定，setIdleStrategy 不起作用
+  constexpr IdleStrategy strategy() const { return Strategy; }
+  constexpr int spinCount() const { return SpinCount; }
+  constexpr int maxBackoff() const { return MaxBackoff; }
+};
+
+using ParkIdle = StaticIdle<IdleStrategy::IDLE_PARK>;
+using BusySpinIdle = StaticIdle<IdleStrategy::IDLE_BUSY_SPIN>;
+using SpinYieldIdle = StaticIdle<IdleStrategy::IDLE_SPIN_YIELD>;
+template <int SpinCount = IDLE_SPIN_COUNT, int MaxBackoff = IDLE_MAX_BACKOFF>
+using SpinParkIdle = StaticIdle<IdleStrategy::IDLE_SPIN_PARK, SpinCount, MaxBackoff>;
+
+//////////////
+// 任务存储：只能移动的任务包装。packaged_task 可以直接移动进来，不需要再套一层 shared_ptr
+class UniqueTask
+{
+public:
+  UniqueTask() = default;
+  template <typename Fun, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Fun>, UniqueTask>>>
+  UniqueTask(Fun&& func)
+    : impl_(std::make_unique<Impl<std::decay_t<Fun>>>(std::forward<Fun>(func)))
+  {}
+  UniqueTask(UniqueTask&&) = default;
+  UniqueTask& operator=(UniqueTask&&) = default;
+
+  void operator()() { impl_->call(); }
+  explicit operator bool() const { return impl_ != nullptr; }
+
+private:
+  struct Base
+  {
+    virtual ~Base() = default;
+    virtual void call() = 0;
+  };
+  template <typename Fun>
+  struct Impl : public Base
+  {
+    explicit Impl(Fun&& f):func(std::move(f)){}
+    explicit Impl(const Fun& f):func(f){}
+    void call() override { func(); }
+    Fun func;
+  };
+  std::unique_ptr<Base> impl_;
+};
+
+//////////////
+// 统计策略
+class NoStats
+{
+public:
+  static constexpr bool TRACK_WORKERS = false;  // 不记录工作线程，执行任务时没有额外开销
+  void onSubmit() {}
+  void onReject() {}
+  void onExecute() {}
+  void onUnhandled() {}
+};
+
+class CountingStats
+{
+public:
+  static constexpr bool TRACK_WORKERS = true;  // 每个工作线程记录当前任务的名字和开始时间
+  void onSubmit() { submitted_.fetch_add(1, std::memory_order_relaxed); }
+  void onReject() { rejected_.fetch_add(1, std::memory_order_relaxed); }
+  void onExecute() { executed_.fetch_add(1, std::memory_order_relaxed); }
+  void onUnhandled() { unhandled_.fetch_add(1, std::memory_order_relaxed); }
+
+  unsigned long long submitted() const { return submitted_; }  // 提交成功的任务数
+  unsigned long long rejected() const { return rejected_; }  // 队列满提交失败的任务数
+  unsigned long long executed() const { return executed_; }  // 执行完的任务数
+  unsigned long long unhandled() const { return unhandled_; }  // 交给错误处理函数的异常数
+private:
+  std::atomic<unsigned long long> submitted_{0};
+  std::atomic<unsigned long long> rejected_{0};
+  std::atomic<unsigned long long> executed_{0};
+  std::atomic<unsigned long long> unhandled_{0};
+};
+
+//////////////
+// 队列策略：QueuePolicy::Queue<T> 提供
+//   NEEDS_POOL_LOCK  为 true 时 push/pop 在线程池的 mtx_ 下调用，否则队列自己保证线程安全
+//   init(capacity)   设置容量，线程池启动前调用，可以调用多次，已经放进队列的任务要保留
+//   push(task, worker) / pop(task, worker)   worker 是当前工作线程的id，不是工作线程时为 -1；
+//                    push 返回 false 时 task 必须原样保留，线程池会重试
+// 队列里的任务数由线程池的 taskSize_ 控制，不会超过 capacity
+struct MutexQueue
+{
+  template <typename T>
+  class Queue
+  {
+  public:
+    static constexpr bool NEEDS_POOL_LOCK = true;
+    void init(std::size_t) {}
+    bool push(T&& task, int) { queue_.emplace(std::move(task)); return true; }
+    bool pop(T& task, int)
+    {
+        if(queue_.empty()) return false;
+        task = std::move(queue_.front());
+        queue_.pop();
+        return true;
+    }
+  private:
+    std::queue<T> queue_;
+  };
+};
+
+// 有界无锁队列，提交和取任务都不需要线程池的锁
+struct LockFreeQueue
+{
+  template <typename T>
+  class Queue
+  {
+  public:
+    static constexpr bool NEEDS_POOL_LOCK = false;
+    void init(std::size_t capacity)
+    {
+        // 启动前提交的任务搬到新的队列里，容量至少放得下它们
+        std::vector<T> tasks;
+        T task;
+        while(channel_ && channel_->tryPop(task)){
+            tasks.emplace_back(std::move(task));
+        }
+        channel_ = std::make_unique<MpmcChannel<T>>(std::max(capacity, tasks.size()));
+        for(auto& item : tasks){
+            channel_->tryPush(std::move(item));
+        }
+    }
+    bool push(T&& task, int) { return channel_->tryPush(std::move(task)); }
+    bool pop(T& task, int) { return channel_->tryPop(task); }
+  private:
+    std::unique_ptr<MpmcChannel<T>> channel_;
+  };
+};
+
+// 工作窃取：每个工作线程（按id取模）有自己的双端队列，
+// 工作线程提交的任务放进自己的队列，从尾部取（后进先出，数据还在缓存里）；
+// 自己的队列空了再从别的队列头部偷。每个队列一把锁，只有偷任务时才会竞争。不保证先进先出
+struct WorkStealingQueue
+{
+  template <typename T>
+  class Queue
+  {
+  public:
+    static constexpr bool NEEDS_POOL_LOCK = false;
+    Queue()
+      : next_(0)
+    {
+        std::size_t n = std::thread::hardware_concurrency();
+        for(std::size_t i = 0; i < (n > 0 ? n : 1); i++){
+            shards_.emplace_back(std::make_unique<Shard>());
+        }
+    }
+    void init(std::size_t) {}
+    bool push(T&& task, int worker)
+    {
+        // 不是工作线程提交的任务，轮流放到各个队列
+        std::size_t index = worker >= 0 ? worker % shards_.size() : next_++ % shards_.size();
+        Shard& shard = *shards_[index];
+        std::unique_lock<std::mutex> lock(shard.mtx);
+        shard.tasks.emplace_back(std::move(task));
+        return true;
+    }
+    bool pop(T& task, int worker)
+    {
+        std::size_t self = worker >= 0 ? worker % shards_.size() : 0;
+        {
+            Shard& shard = *shards_[self];
+            std::unique_lock<std::mutex> lock(shard.mtx);
+            if(!shard.tasks.empty()){
+                task = std::move(shard.tasks.back());
+                shard.tasks.pop_back();
+                return true;
+            }
+        }
+        for(std::size_t i = 1; i < shards_.size(); i++){
+            Shard& shard = *shards_[(self + i) % shards_.size()];
+            std::unique_lock<std::mutex> lock(shard.mtx);
+            if(!shard.tasks.empty()){
+                task = std::move(shard.tasks.front());
+                shard.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+  private:
+    struct Shard
+    {
+        std::mutex mtx;
+        std::deque<T> tasks;
+    };
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<std::size_t> next_;
+  };
+};
+
+#endif
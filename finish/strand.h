@@ -0,0 +1,164 @@
+#ifndef STRAND_H
+#define STRAND_H
+
+#include "threadpool.h"
+
+const int STRAND_MAX_BATCH = 64;  // 一次调度最多连续执行的任务数，超过后重新排队，避免长期霸占工作线程
+
+/*
+Strand：串行执行器
+1. 提交到同一个 Strand 的任务按提交顺序一个一个执行，不会并发，但可能在任意工作线程上执行
+2. 不同的 Strand 之间并行执行
+3. 任务放在无锁的多生产者单消费者队列里，每个 Strand 同一时刻最多只有一个线程池任务在取队列，
+   所以不需要在任务里加锁，也不会有工作线程阻塞在别的 Strand 上
+
+example:
+ThreadPool pool;
+pool.start(4);
+
+Strand session(pool);  // 比如每个会话一个 Strand
+std::future<int> res = session.post([](int a, int b){ return a + b; }, 1, 2);
+
+Strand 是可以拷贝的句柄，拷贝出来的对象指向同一个队列。
+用别的线程池类型时写 BasicStrand<FastPool> session(fastPool);
+*/
+template <typename Pool = ThreadPool>
+class BasicStrand
+{
+public:
+  explicit BasicStrand(Pool& pool)
+    : impl_(std::make_shared<Impl>(pool))
+  {}
+
+  template <typename Fun, typename ... Args>
+  auto post(Fun&& func, Args&& ...args) -> std::future<decltype(func(args...))>
+  {
+    using Rtype = decltype(func(args...));
+    auto task = std::make_shared<std::packaged_task<Rtype()>>(
+        std::bind(std::forward<Fun>(func), std::forward<Args>(args)...));
+    std::future<Rtype> result = task->get_future();
+
+    Node* node = new Node;
+    node->task = [task](){ (*task)(); };
+    impl_->push(node);
+
+    // 队列从空变成非空，由这次提交负责调度
+    if(impl_->pending_.fetch_add(1) == 0){
+        impl_->schedule();
+    }
+    return result;
+  }
+
+private:
+  struct Node
+  {
+    std::function<void()> task;
+    std::atomic<Node*> next{nullptr};
+  };
+
+  // Vyukov 的无锁 MPSC 队列，head_ 由生产者修改，tail_ 只有当前调度的那个任务访问
+  struct Impl : public std::enable_shared_from_this<Impl>
+  {
+    explicit Impl(Pool& pool)
+      : pool_(pool),
+        head_(&stub_),
+        tail_(&stub_),
+        pending_(0)
+    {}
+
+    ~Impl()
+    {
+        // 只有没有调度中的任务时才会析构，这里把没执行的节点释放掉
+        while(Node* node = pop()){
+            delete node;
+        }
+    }
+
+    void push(Node* node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // 生产者刚交换完 head_ 还没链上 next 时会返回 nullptr
+    Node* pop()
+    {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if(tail == &stub_){
+            if(next == nullptr){
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if(next != nullptr){
+            tail_ = next;
+            return tail;
+        }
+        if(tail != head_.load(std::memory_order_acquire)){
+            return nullptr;
+        }
+        push(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if(next != nullptr){
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    // 调度一次 drain。线程池队列满了提交不进去，就在当前线程直接执行：
+    // pending_ 已经不是0了，这次调度丢掉的话，之后的提交都不会再调度，Strand 就卡死了
+    void schedule()
+    {
+        if(!resubmit()){
+            drain();
+        }
+    }
+
+    bool resubmit()
+    {
+        return pool_.trySubmitTask([self = this->shared_from_this()](){ self->drain(); });
+    }
+
+    void drain()
+    {
+        for(;;)
+        {
+            for(int i = 0; i < STRAND_MAX_BATCH; i++){
+                Node* node = pop();
+                while(node == nullptr){
+                    // pending_ 保证队列里有任务，只是生产者还没链接好
+                    std::this_thread::yield();
+                    node = pop();
+                }
+                node->task();
+                delete node;
+
+                if(pending_.fetch_sub(1) == 1){
+                    return;  // 队列空了，下一次提交会重新调度
+                }
+            }
+            // 还有任务，重新排到线程池队列的末尾，让其他任务也有机会执行；队列满了就接着执行
+            if(resubmit()){
+                return;
+            }
+        }
+    }
+
+    Pool& pool_;
+    std::atomic<Node*> head_;
+    Node* tail_;
+    Node stub_;
+    std::atomic<std::size_t> pending_;  // 队列里还没执行完的任务数
+  };
+
+  std::shared_ptr<Impl> impl_;
+};
+
+using Strand = BasicStrand<>;
+
+#endif
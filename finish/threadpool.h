@@ -12,26 +12,301 @@
 #include <unordered_map>
 #include <thread>
 #include <future>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include "policy.h"
 
 const int TASK_MAX_THRESHHOLD = 1024;
 const int THREAD_MAX_THRESHHOLD = 200;
 const int THREAD_MAX_IDLE_TIME = 60; //单位：秒
+const int SUBMIT_MAX_DELAY = 100;  // 批量提交时任务在缓冲里最多停留的时间，单位：微秒
+const int LIFO_MAX_STREAK = 3;  // 工作线程连续执行自己槽里任务的上限，超过后让公共队列的任务先执行
+const int LIFO_STEAL_DELAY = 20;  // 槽里的任务等了这么久还没执行，空闲线程可以偷走，单位：微秒
+const int WATCHDOG_INTERVAL = 100;  // 看门狗的采样间隔，单位：毫秒
+const int TASK_NAME_SIZE = 32;  // 任务名最多保存的字节数（含结尾的'\0'），超出的部分截掉，必须是8的倍数
 
-class ThreadPool
+//////////////
+// 任务的完成状态：std::future 不能挂回调，所以每个任务再带一个完成状态，
+// 上面可以登记多个回调，任务执行完（不管正常返回还是抛异常）时在工作线程里依次调用。
+// 没有登记回调的任务完成时只有一次原子交换，不拿锁
+class Completion
 {
 public:
-  ThreadPool():
-            poolMode_(PoolMode::MODE_FIXED),
+  Completion():state_(STATE_EMPTY){}
+
+  // 任务执行完调用
+  void complete()
+  {
+    if(state_.exchange(STATE_DONE) != STATE_LISTENED){
+        return;
+    }
+    // 取出来再调用，打断 回调 => 聚合状态 => future => Completion 的循环引用
+    std::vector<std::function<void()>> listeners;
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        listeners.swap(listeners_);
+    }
+    for(auto& cb : listeners){
+        cb();
+    }
+  }
+
+  // 登记回调，可以登记多次（比如先被 whenAny 聚合，再挂 then）；任务已经完成的话立即在当前线程调用
+  void listen(std::function<void()> cb)
+  {
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        int expected = STATE_EMPTY;
+        if(state_.compare_exchange_strong(expected, STATE_LISTENED) || expected == STATE_LISTENED){
+            listeners_.emplace_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+  }
+
+  bool isDone() const
+  {
+    return state_ == STATE_DONE;
+  }
+
+private:
+  static constexpr int STATE_EMPTY = 0;
+  static constexpr int STATE_LISTENED = 1;
+  static constexpr int STATE_DONE = 2;
+
+  std::atomic_int state_;
+  std::mutex mtx_;  // 保护 listeners_，只有登记了回调才会用到
+  std::vector<std::function<void()>> listeners_;
+};
+
+// submitTask 的返回值：就是一个 std::future，额外带着任务的完成状态，
+// 可以交给 whenAll/whenAny 聚合，或者用 then 挂一个续作
+template <typename R>
+class TaskFuture : public std::future<R>
+{
+public:
+  TaskFuture() = default;
+  TaskFuture(std::future<R>&& future, std::shared_ptr<Completion> completion)
+    : std::future<R>(std::move(future)),
+      completion_(std::move(completion))
+  {}
+  TaskFuture(TaskFuture&&) = default;
+  TaskFuture& operator=(TaskFuture&&) = default;
+
+  std::shared_ptr<Completion> completion() const
+  {
+    return completion_;
+  }
+
+  // 任务完成后，把 func(已完成的future) 作为新任务提交到线程池，不占用等待的线程；线程池队列满了就直接执行
+  template <typename Pool, typename Fun>
+  auto then(Pool& pool, Fun&& func) -> TaskFuture<decltype(func(std::declval<TaskFuture<R>>()))>;
+
+private:
+  std::shared_ptr<Completion> completion_;
+};
+
+class Thread
+{
+public:
+  using ThreadFunc = std::function<void(int)>;
+
+  Thread(ThreadFunc func):func_(func), threadId_(generate_++){}
+  ~Thread() = default;
+  void start()
+  {
+    std::thread t(func_, threadId_);
+    t.detach();
+  }
+  int getId() const
+  {
+    return threadId_; 
+  }
+private:
+  ThreadFunc func_;
+  inline static int generate_ = 0;
+  int threadId_; //保存线程id --- 不是真的线程id，是我们generate自增
+};
+
+// 任务名，提交时作为第一个参数：pool.submitTask(TaskName("parse"), func, args...)
+// 名字拷贝一份保存，调用者的字符串提交完就可以释放；超过 TASK_NAME_SIZE - 1 个字节的部分截掉
+struct TaskName
+{
+    explicit TaskName(const char* n) { copy(n != nullptr ? n : "", n != nullptr ? std::strlen(n) : 0); }
+    explicit TaskName(const std::string& n) { copy(n.data(), n.size()); }
+
+    char name[TASK_NAME_SIZE];
+private:
+    void copy(const char* n, std::size_t len)
+    {
+        len = std::min<std::size_t>(len, TASK_NAME_SIZE - 1);
+        std::memcpy(name, n, len);
+        std::memset(name + len, 0, TASK_NAME_SIZE - len);
+    }
+};
+
+// 看门狗发现的执行太久的任务
+struct StuckTask
+{
+    int threadId;  // 工作线程id
+    std::string name;  // 任务名，没有名字时为空
+    std::chrono::milliseconds runningFor;  // 已经执行了多久
+};
+
+enum class DumpFormat
+{
+    DUMP_TEXT,
+    DUMP_JSON,
+};
+
+//////////////
+// 工作线程当前在执行什么：只有工作线程自己写，dumpState 和看门狗随时读，都不加锁。
+// 用序号做顺序锁：写之前序号变奇数，写完变偶数，读的一方读到奇数或者前后序号不一样就重读
+class alignas(64) WorkerRecord
+{
+public:
+  struct Snapshot
+  {
+    int threadId;
+    std::uint64_t executed;  // 开始执行过的任务数，也是当前任务的编号
+    long long start;  // 当前任务的开始时间（steady_clock），0 表示空闲
+    char name[TASK_NAME_SIZE];  // 任务名，没有名字时为空串
+  };
+
+  // 工作线程启动时占一个记录，返回false表示已经被占了
+  bool claim(int threadId)
+  {
+    bool expected = false;
+    if(!inUse_.compare_exchange_strong(expected, true)){
+        return false;
+    }
+    write(threadId, 0, nullptr, false);
+    return true;
+  }
+  void release() { inUse_ = false; }
+  bool inUse() const { return inUse_; }
+
+  // 开始执行一个任务，返回之前的状态（在任务里直接执行另一个任务时，结束后要恢复）
+  Snapshot begin()
+  {
+    Snapshot prev = snapshot();
+    write(prev.threadId, std::chrono::steady_clock::now().time_since_epoch().count(), nullptr, true);
+    return prev;
+  }
+  void end(const Snapshot& prev) { write(prev.threadId, prev.start, prev.name, false); }
+  void rename(const char* name)  // name 是 TASK_NAME_SIZE 字节、以'\0'结尾的缓冲
+  {
+    Snapshot cur = snapshot();
+    write(cur.threadId, cur.start, name, false);
+  }
+
+  Snapshot snapshot() const
+  {
+    for(;;)
+    {
+        std::uint64_t seq = seq_.load(std::memory_order_acquire);
+        if(seq & 1){
+            cpuRelax();
+            continue;
+        }
+        Snapshot s{threadId_.load(std::memory_order_relaxed), executed_.load(std::memory_order_relaxed),
+                   start_.load(std::memory_order_relaxed), {}};
+        for(int i = 0; i < NAME_WORDS; i++){
+            std::uint64_t word = name_[i].load(std::memory_order_relaxed);
+            std::memcpy(s.name + i * sizeof(word), &word, sizeof(word));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(seq_.load(std::memory_order_relaxed) == seq){
+            return s;
+        }
+    }
+  }
+
+private:
+  void write(int threadId, long long start, const char* name, bool newTask)
+  {
+    std::uint64_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    threadId_.store(threadId, std::memory_order_relaxed);
+    if(newTask){
+        executed_.store(executed_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    start_.store(start, std::memory_order_relaxed);
+    // 名字按8字节一组存成原子变量，和读的一方并发也不是数据竞争，读到写了一半的名字靠序号重读
+    for(int i = 0; i < NAME_WORDS; i++){
+        std::uint64_t word = 0;
+        if(name != nullptr){
+            std::memcpy(&word, name + i * sizeof(word), sizeof(word));
+        }
+        name_[i].store(word, std::memory_order_relaxed);
+    }
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  static constexpr int NAME_WORDS = TASK_NAME_SIZE / sizeof(std::uint64_t);
+
+  std::atomic_bool inUse_{false};
+  std::atomic<std::uint64_t> seq_{0};
+  std::atomic_int threadId_{-1};
+  std::atomic<std::uint64_t> executed_{0};
+  std::atomic<long long> start_{0};
+  std::atomic<std::uint64_t> name_[NAME_WORDS] = {};
+};
+
+/*
+BasicThreadPool：线程池的各个部分都可以在编译期换掉，用不到的功能不产生任何开销
+QueuePolicy  任务队列    MutexQueue / LockFreeQueue / WorkStealingQueue
+IdlePolicy   空闲等待    RuntimeIdle / ParkIdle / BusySpinIdle / SpinYieldIdle / SpinParkIdle<>
+TaskType     任务存储    std::function<void()> / UniqueTask（只能移动，省掉一次 shared_ptr）
+StatsPolicy  统计        NoStats / CountingStats
+ModePolicy   线程池模式  RuntimeMode / FixedMode / CachedMode
+具体见 policy.h。全部用默认参数就是原来的 ThreadPool，接口和行为都不变
+
+example:
+using FastPool = BasicThreadPool<LockFreeQueue, SpinParkIdle<>, UniqueTask, CountingStats, FixedMode>;
+FastPool pool;
+pool.start(4);
+pool.submitTask(sum1, 1, 2).get();
+std::cout << pool.stats().executed() << std::endl;
+*/
+template <typename QueuePolicy = MutexQueue,
+          typename IdlePolicy = RuntimeIdle,
+          typename TaskType = std::function<void()>,
+          typename StatsPolicy = NoStats,
+          typename ModePolicy = RuntimeMode>
+class BasicThreadPool
+{
+public:
+  BasicThreadPool():
             initThreadSize_(0),
             idleThreadSize_(0),
-            threadThreshHold_(THREAD_MAX_THRESHHOLD),
             curThreadSize_(0),
+            threadThreshHold_(THREAD_MAX_THRESHHOLD),
             taskSize_(0),
             taskQueThreshHold_(TASK_MAX_THRESHHOLD),
+            sleepers_(0),
+            batchSize_(1),
+            maxDelay_(std::chrono::microseconds(SUBMIT_MAX_DELAY)),
+            buffered_(0),
+            nextScan_(0),
+            slotted_(0),
+            recordCount_(0),
+            watchdogThreshold_(0),
+            watchdogInterval_(WATCHDOG_INTERVAL),
+            watchdogStop_(false),
             isPoolRunning_(false)
-            {}
-  ~ThreadPool()
+            {
+              taskQueue_.init(taskQueThreshHold_);
+            }
+  ~BasicThreadPool()
 {
+    // 缓冲里还没发布的任务也要执行完
+    flushAll();
     isPoolRunning_ = false;
 
     // 线程会在notEmpty_处wait，释放锁，处于等待状态。所以现在线程池里，线程要么是处于等待状态，要么是正在运行任务
@@ -43,80 +318,271 @@ public:
     std::unique_lock<std::mutex> lock(mtx_);
 
     notEmpty_.notify_all();
-    exitCond_.wait(lock, [&]()->bool { threads_.size() == 0; }); // 等待线程对象全部被回收
+    exitCond_.wait(lock, [&]()->bool { return threads_.size() == 0; }); // 等待线程对象全部被回收
 
+    // 线程都退出了，最后停掉看门狗
+    {
+        std::unique_lock<std::mutex> watchdogLock(watchdogMtx_);
+        watchdogStop_ = true;
+    }
+    watchdogCond_.notify_all();
+    if(watchdog_.joinable()){
+        watchdog_.join();
+    }
 }
-  ThreadPool(const ThreadPool&) = delete;
-  ThreadPool& operator=(const ThreadPool&) = delete;
+  BasicThreadPool(const BasicThreadPool&) = delete;
+  BasicThreadPool& operator=(const BasicThreadPool&) = delete;
 
   void setMode(PoolMode mode)
   {
     if(checkRunningState()){
         return;
     }
-    poolMode_ = mode;
+    poolMode_.set(mode);
   }
   void setTaskQueThreshHold(int threshHold){  //设置任务队列阈值
     if(checkRunningState()) return;
     taskQueThreshHold_ = threshHold;
+    // 队列的容量要跟着阈值变，否则 taskSize_ 占到了名额，队列却放不下
+    taskQueue_.init(taskQueThreshHold_);
+    if(batchSize_ > taskQueThreshHold_){
+        batchSize_ = taskQueThreshHold_;
+    }
   }
   void setThreadThreshHold(int threshHold){  //设置线程阈值
-    if(checkRunningState) return;
-    if(poolMode_ == PoolMode::MODE_CACHED){
+    if(checkRunningState()) return;
+    if(poolMode_.isCached()){
         threadThreshHold_ = threshHold;
     }
   }
+  // 设置错误处理函数，任务里没有被future接住的异常交给它处理，工作线程不会因此退出
+  // submitTask提交的任务，异常都保存在返回的future里，get时重新抛出
+  void setErrorHandler(std::function<void(std::exception_ptr)> handler){
+    if(checkRunningState()) return;
+    errorHandler_ = handler;
+  }
+  // 设置空闲等待策略，spinCount 是自旋检查的次数，maxBackoff 是 IDLE_SPIN_PARK 退避的上限
+  // 注意：IDLE_BUSY_SPIN 和 IDLE_SPIN_YIELD 不会睡眠，cached模式下多出来的线程也不会被回收
+  // IdlePolicy 不是 RuntimeIdle 时策略在编译期已经确定，这里不起作用
+  void setIdleStrategy(IdleStrategy strategy, int spinCount = IDLE_SPIN_COUNT, int maxBackoff = IDLE_MAX_BACKOFF){
+    if(checkRunningState()) return;
+    idle_.set(strategy, spinCount, maxBackoff);
+  }
+  // 打开批量提交（默认关闭，batchSize <= 1）：每个提交任务的线程先把任务攒在自己的缓冲里，
+  // 攒够 batchSize 个、最早的任务等了 maxDelay、或者调用 flush() 时，一次放进任务队列。
+  // 生产者很多、任务很小时，大大减少 mtx_ / notFull_ 上的竞争，代价是任务最多晚 maxDelay 开始执行。
+  // 注意：批量提交的任务如果因为队列满提交失败，future.get() 抛出 broken_promise
+  void setSubmitBatch(int batchSize, std::chrono::microseconds maxDelay = std::chrono::microseconds(SUBMIT_MAX_DELAY)){
+    if(checkRunningState()) return;
+    batchSize_ = batchSize > 1 ? batchSize : 1;
+    if(batchSize_ > taskQueThreshHold_){
+        batchSize_ = taskQueThreshHold_;  // 一批必须能放进任务队列
+    }
+    maxDelay_ = maxDelay;
+  }
+  // 把当前线程缓冲的任务立即放进任务队列
+  void flush()
+  {
+    if(batchSize_ <= 1){
+        return;
+    }
+    SubmitBuffer& buffer = localBuffer();
+    std::vector<Task> tasks;
+    std::vector<std::shared_ptr<Completion>> dones;
+    {
+        std::unique_lock<std::mutex> lock(buffer.mtx);
+        takeBuffer(buffer, tasks, dones);
+    }
+    publish(tasks, dones);
+  }
+  // 打开看门狗：后台线程每隔 interval 采样一次各个工作线程的记录（不加锁），
+  // 任务执行超过 threshold 时调用 onStuck 报告一次，onStuck 为空时打印到 std::cerr
+  // 要求 StatsPolicy::TRACK_WORKERS（比如 CountingStats）
+  void setWatchdog(std::chrono::milliseconds threshold,
+                   std::function<void(const StuckTask&)> onStuck = nullptr,
+                   std::chrono::milliseconds interval = std::chrono::milliseconds(WATCHDOG_INTERVAL)){
+    static_assert(StatsPolicy::TRACK_WORKERS, "watchdog needs a StatsPolicy with TRACK_WORKERS, e.g. CountingStats");
+    if(checkRunningState()) return;
+    watchdogThreshold_ = threshold;
+    watchdogInterval_ = interval;
+    onStuck_ = onStuck;
+  }
+
+  // 线程池当前状态：线程数、排队的任务数、每个工作线程在执行的任务和执行了多久。
+  // 只读原子变量，不拿锁，线程池卡住的时候也能调用；各项数据不是同一时刻的快照。
+  // StatsPolicy 不记录工作线程（NoStats）时 workers 为空
+  std::string dumpState(DumpFormat format = DumpFormat::DUMP_TEXT) const
+  {
+    long long now = std::chrono::steady_clock::now().time_since_epoch().count();
+    bool json = format == DumpFormat::DUMP_JSON;
+    std::ostringstream out;
+    if(json){
+        out << "{\"mode\":\"" << (poolMode_.isCached() ? "cached" : "fixed") << "\""
+            << ",\"running\":" << (isPoolRunning_ ? "true" : "false")
+            << ",\"threads\":" << curThreadSize_
+            << ",\"idleThreads\":" << idleThreadSize_
+            << ",\"queuedTasks\":" << taskSize_
+            << ",\"queueLimit\":" << taskQueThreshHold_
+            << ",\"bufferedTasks\":" << buffered_
+            << ",\"slottedTasks\":" << slotted_
+            << ",\"workers\":[";
+    }
+    else {
+        out << "pool: mode=" << (poolMode_.isCached() ? "cached" : "fixed")
+            << " running=" << (isPoolRunning_ ? "true" : "false")
+            << " threads=" << curThreadSize_
+            << " idle=" << idleThreadSize_
+            << " queued=" << taskSize_ << "/" << taskQueThreshHold_
+            << " buffered=" << buffered_
+            << " slotted=" << slotted_ << "\n";
+    }
+    bool first = true;
+    for(std::size_t i = 0; i < recordCount_; i++)
+    {
+        if(!records_[i].inUse()){
+            continue;
+        }
+        WorkerRecord::Snapshot s = records_[i].snapshot();
+        long long runningMs = s.start != 0 ? std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::duration(now - s.start)).count() : 0;
+        if(json){
+            out << (first ? "" : ",")
+                << "{\"id\":" << s.threadId
+                << ",\"state\":\"" << (s.start != 0 ? "running" : "idle") << "\""
+                << ",\"task\":";
+            if(s.name[0] != '\0'){
+                out << "\"";
+                jsonEscape(out, s.name);
+                out << "\"";
+            }
+            else {
+                out << "null";
+            }
+            out << ",\"runningMs\":" << runningMs
+                << ",\"executed\":" << s.executed << "}";
+        }
+        else {
+            out << "  worker " << s.threadId << ": ";
+            if(s.start != 0){
+                out << "running " << (s.name[0] != '\0' ? s.name : "<unnamed>") << " for " << runningMs << "ms";
+            }
+            else {
+                out << "idle";
+            }
+            out << ", executed " << s.executed << "\n";
+        }
+        first = false;
+    }
+    if(json){
+        out << "]}";
+    }
+    return out.str();
+  }
+
+  // 统计数据，StatsPolicy 是 NoStats 时没有内容
+  const StatsPolicy& stats() const
+  {
+    return stats_;
+  }
 
 
 // 使用可变参模板编程，让submitTask可以接收任意任务函数和任意数量的参数
   template <typename Fun, typename ... Args>
-  auto submitTask(Fun&& func, Args&& ...args) -> std::future<decltype(func(args...))>
+  auto submitTask(Fun&& func, Args&& ...args) -> TaskFuture<decltype(func(args...))>
   {
     using Rtype = decltype(func(args...));
-    auto task = std::make_shared<std::packaged_task<Rtype()>>(
-        std::bind(std::forward<Fun>(func), std::forward<Args>(args...)));
-    future<Rtype> result = task->get_future();
+    auto done = std::make_shared<Completion>();
+    TaskFuture<Rtype> result;
+    Task wrapper = makeTask(result, done, std::forward<Fun>(func), std::forward<Args>(args)...);
 
-    std::unique_lock<std::mutex> lock(mtx_);
-    //线程的通信  等待任务队列有空余
-    // 提交任务，最长阻塞时间不超过1s，否则任务提交失败，返回
-    if(!notFull_.wait_for(lock, std::chrono::seconds(1), [&]()->bool { return taskQueue_.size() < taskQueThreshHold_; }))
-    {
-        //等待了1s，任务提交失败
-        std::cerr << "task queue is full. submit task fail." << std::endl;
-        auto task = std::make_shared<std::packaged_task<Rtype()>>(
-            []() ->Rtype { return Rtype(); });
-        (*task)();
-        return task.get_future();
+    if(batchSize_ > 1){
+        // 打开了批量提交，先放进当前线程的缓冲
+        bufferTask(std::move(wrapper), std::move(done));
+        return result;
     }
+    if(!enqueue(&wrapper, 1)){
+        return rejectTask<Rtype>(done);
+    }
+    stats_.onSubmit();
 
+    return result;
+  }
+  // 带名字提交，名字会出现在 dumpState 和看门狗的报告里；不记录工作线程时名字直接丢掉
+  template <typename Fun, typename ... Args>
+  auto submitTask(TaskName name, Fun&& func, Args&& ...args) -> TaskFuture<decltype(func(args...))>
+  {
+    if constexpr (!StatsPolicy::TRACK_WORKERS){
+        return submitTask(std::forward<Fun>(func), std::forward<Args>(args)...);
+    }
+    else {
+        return submitTask([name, call = std::bind(std::forward<Fun>(func), std::forward<Args>(args)...)]() mutable {
+            if(workerRecord_ != nullptr){
+                workerRecord_->rename(name.name);
+            }
+            return call();
+        });
+    }
+  }
 
-    //如果有空余了，就将任务放入任务队列
-    //taskQueue_.emplace(sp);
-    // using Task = std::function<void()>
-    taskQueue_.emplace([task](){ (*task)(); });
-
-    taskSize_++;
-    //因为新放了任务，任务队列肯定不空了，在notEmpty上进行通知
-    notEmpty_.notify_all();
+  // 不等待的提交：队列满了立即返回 false，任务不会执行，由调用者决定怎么办（比如直接在当前线程执行）。
+  // 不返回 future，也不经过批量提交的缓冲，给 Strand、Pipeline 这类自己管理完成状态的调度任务用
+  template <typename Fun>
+  bool trySubmitTask(Fun&& func)
+  {
+    Task task(std::forward<Fun>(func));
+    if(!enqueue(&task, 1, false)){
+        return false;
+    }
+    stats_.onSubmit();
+    return true;
+  }
 
-    // cached模式下，根据空闲线程和任务数量的情况，判断是否需要新建线程
-    if(poolMode_ == PoolMode::MODE_CACHED
-      && taskSize_ > idleThreadSize_
-      && curThreadSize_ < threadThreshHold_)
-      {
-        // 创建新线程
-        auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
-        //threads_.emplace_back(ptr);
-        int threadId = ptr->getId();
-        threads_.emplace(threadId, std::move(ptr));
-        threads_[threadId]->start(); // 让新建的线程运行起来
-        curThreadSize_++;
-        idleThreadSize_++;
-      }
+  // 在工作线程里提交，任务放进当前工作线程的槽，当前任务执行完马上由这个线程执行，数据还在它的缓存里
+  // （类似 Go 的 runnext / Tokio 的 LIFO slot），适合 生产数据 => 提交消费者 这样的任务链。
+  // 槽里原来的任务移到公共队列末尾；连续执行 LIFO_MAX_STREAK 个槽里的任务后，下一个也移到公共队列，
+  // 一条任务链不会一直霸占工作线程；当前任务执行太久时，空闲线程过 LIFO_STEAL_DELAY 会把它偷走。
+  // 不是本线程池的工作线程调用时，和 submitTask 一样
+  template <typename Fun, typename ... Args>
+  auto submitTaskNext(Fun&& func, Args&& ...args) -> TaskFuture<decltype(func(args...))>
+  {
+    using Rtype = decltype(func(args...));
+    if(currentWorker() < 0){
+        return submitTask(std::forward<Fun>(func), std::forward<Args>(args)...);
+    }
+    auto done = std::make_shared<Completion>();
+    TaskFuture<Rtype> result;
+    Task wrapper = makeTask(result, done, std::forward<Fun>(func), std::forward<Args>(args)...);
 
+    Task displaced;
+    slotted_++;
+    if(slotPut(*workerSlot_, std::move(wrapper), displaced)){
+        slotted_--;
+        // 原来的任务踢到公共队列末尾，队列满了就在当前线程直接执行
+        if(!enqueue(&displaced, 1, false)){
+            runTask(displaced);
+        }
+    }
+    else {
+        // 有线程睡眠的话叫醒一个，当前任务执行太久时由它来偷
+        if(sleepers_ > 0){
+            std::unique_lock<std::mutex> lock(mtx_);
+            notEmpty_.notify_one();
+        }
+        // cached模式下没有空闲线程，和 submitTask 一样新建一个
+        if(poolMode_.isCached()
+          && idleThreadSize_ == 0
+          && curThreadSize_ < threadThreshHold_)
+          {
+            std::unique_lock<std::mutex> lock(mtx_);
+            if(curThreadSize_ < threadThreshHold_){
+                addThread();
+            }
+          }
+    }
+    stats_.onSubmit();
     return result;
   }
+
   // 线程初始的默认值为当前cpu的核心数量
   void start(int initThreadSize = std::thread::hardware_concurrency()) // 开启线程池
   {
@@ -125,28 +591,66 @@ public:
     //线程的初始个数
     initThreadSize_ = initThreadSize;
     curThreadSize_ = initThreadSize_;
+
+    // 每个工作线程一个记录，cached模式按线程数量的阈值分配，之后不再变化，读的时候不用加锁
+    if constexpr (StatsPolicy::TRACK_WORKERS){
+        recordCount_ = poolMode_.isCached() ? std::max(threadThreshHold_, initThreadSize_) : initThreadSize_;
+        records_ = std::make_unique<WorkerRecord[]>(recordCount_);
+    }
+
     for(int i = 0;i < initThreadSize_;i++){
         //创建线程对象，把线程函数给到线程对象
-        auto ptr = std::make_unique<Thread>(std::bind(&threadFunc, this, std::placeholders::_1));
-        //threads_.emplace_back(std::move(ptr));
+        auto ptr = std::make_unique<Thread>(std::bind(&BasicThreadPool::threadFunc, this, std::placeholders::_1));
         int threadId = ptr->getId();
         threads_.emplace(threadId, std::move(ptr));
     }
-    for(int i = 0;i < initThreadSize_;i++){
+    for(auto& item : threads_){
         // 启动每一个线程
-        //threads_[i]->start();
-        threads_[i]->start();
+        item.second->start();
         idleThreadSize_++; // 记录空闲线程的数量
     }
+
+    if(watchdogThreshold_.count() > 0){
+        watchdog_ = std::thread(&BasicThreadPool::watchdogFunc, this);
+    }
   }
 
 private:
+  // Task  =>  函数对象
+  using Task = TaskType;
+  using Queue = typename QueuePolicy::template Queue<Task>;
+
   void threadFunc(int threadId) // 线程的运行函数
+  {
+    workerPool_ = this;
+    workerId_ = threadId;
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        auto slot = std::make_unique<WorkerSlot>();
+        workerSlot_ = slot.get();
+        slots_.emplace(threadId, std::move(slot));
+    }
+    workerRecord_ = nullptr;
+    for(std::size_t i = 0; i < recordCount_; i++){
+        if(records_[i].claim(threadId)){
+            workerRecord_ = &records_[i];
+            break;
+        }
+    }
+    if constexpr (Queue::NEEDS_POOL_LOCK){
+        lockedLoop(threadId);
+    }
+    else {
+        lockFreeLoop(threadId);
+    }
+  }
+
+  // 任务队列由 mtx_ 保护
+  void lockedLoop(int threadId)
   {
      auto lastTime = std::chrono::high_resolution_clock().now();
 
 // 所有任务必须执行完成，线程池才可以回收所有资源
-    //while(isPoolRunning_)
     for(;;)
     {
         Task task;
@@ -157,74 +661,752 @@ private:
             // cached模式下，超过initThreadSize的线程，如果距离上次执行的时间超过了60s，需要回收
             // 当前时间 - 上次执行时间  >= 60s
             // 锁 + 双重判断
-            //while(isPoolRunning_ && taskQueue_.size() == 0){
-            while(taskQueue_.size() == 0){
+            while(taskSize_ == 0){
 
                 if(!isPoolRunning_){
-                    threads_.erase(threadId);
-                    std::cout << "threadId: " << std::this_thread::get_id() << " exit!" << std::endl;
-                    exitCond_.notify_all();
+                    exitThread(threadId);
                     return;  // 线程函数结束，线程结束
                 }
-                if(poolMode_ == PoolMode::MODE_CACHED)
+                if(buffered_ > 0)
+                {
+                    // 有任务还在生产者的缓冲里，发布到期的，没到期的最多等到最早的一个到期
+                    lock.unlock();
+                    auto wait = flushExpired();
+                    lock.lock();
+                    if(wait.count() > 0 && taskSize_ == 0){
+                        notEmpty_.wait_for(lock, wait);
+                    }
+                    continue;
+                }
+                if(slotted_ > 0)
+                {
+                    // 别的工作线程槽里有任务，等了太久还没执行就偷过来
+                    if(stealSlot(task)){
+                        break;
+                    }
+                    notEmpty_.wait_for(lock, std::chrono::microseconds(LIFO_STEAL_DELAY));
+                    continue;
+                }
+                if(idle_.strategy() != IdleStrategy::IDLE_PARK)
+                {
+                    // 不拿锁自旋，看到有任务或者线程池要结束了，再回去抢锁
+                    lock.unlock();
+                    bool ready = spinWait();
+                    lock.lock();
+                    // 重新拿锁之前可能已经有任务放进来、通知过了，拿到锁后要再检查一次，否则会带着任务睡下去
+                    if(ready || taskSize_ > 0 || !isPoolRunning_){
+                        continue;
+                    }
+                }
+                // 先登记 sleepers_ 再检查 buffered_ 和 slotted_，和放进缓冲或者槽时 先加计数再看 sleepers_ 对应
+                sleepers_++;
+                if(buffered_ > 0 || slotted_ > 0){
+                    sleepers_--;
+                    continue;
+                }
+                if(poolMode_.isCached())
                 {
                 // 因为要判断空闲时间，我们让它每1s返回一次，进行：当前时间-上次执行时间
                 // 返回可能是因为：超时返回；
-                    if(std::cv_status::timeout ==
-                        notEmpty_.wait_for(lock, std::chrono::seconds(1)))
-                        {
-                            auto now = std::chrono::high_resolution_clock().now(); //当前时间
-                            auto dur = std::chrono::duration_cast<std::chrono::seconds>(now-lastTime);
-                            if(dur.count() >= THREAD_MAX_IDLE_TIME
-                               && curThreadSize_ > initThreadSize_){
-                                //开始回收当前线程
-                                //线程数量相关变量的修改
-                                //将线程从列表中移除
-                                //我们需要一个映射关系，threadFunc找到列表中的thread. threadId => thread对象 =>删除
-                                threads_.erase(threadId);
-                                curThreadSize_--;
-                                idleThreadSize_--;
-
-                                std::cout << "threadId: " << std::this_thread::get_id() << " exit!" << std::endl;
-                                return;
-                            }
-                        }
+                    bool timeout = std::cv_status::timeout ==
+                        notEmpty_.wait_for(lock, std::chrono::seconds(1));
+                    sleepers_--;
+                    if(timeout && retireIdle(threadId, lastTime)){
+                        return;
+                    }
                 }
                   else {
                 //如果任务队列空的话，要等待
                    notEmpty_.wait(lock);
+                   sleepers_--;
                 }
             }
 
             idleThreadSize_--;
 
-            //任务队列不空，取一个任务出来
-            task = taskQueue_.front();
-            taskQueue_.pop();
+            if(!task){
+                //任务队列不空，取一个任务出来
+                taskQueue_.pop(task, threadId);
+                taskSize_--;
+
+                //如果还有任务，通知其他线程取任务
+                if(taskSize_ > 0){
+                    notEmpty_.notify_all();
+                }
+
+                //取出任务，任务队列不满，可以继续生产任务
+                notFull_.notify_all();
+            }
+
+            //把锁释放掉
+        }
+
+        runTask(task);
+        runSlot();
+        if(buffered_ > 0){
+            maybeFlush();
+        }
+
+        idleThreadSize_++;
+
+        lastTime = std::chrono::high_resolution_clock().now();
+
+    }
+
+  }
+
+  // 队列自己保证线程安全，取任务不拿锁，只有睡眠和退出时才用 mtx_
+  void lockFreeLoop(int threadId)
+  {
+    auto lastTime = std::chrono::high_resolution_clock().now();
+
+    for(;;)
+    {
+        Task task;
+        if(taskQueue_.pop(task, threadId)){
             taskSize_--;
+            idleThreadSize_--;
 
-            //如果还有任务，通知其他线程取任务
-            if(taskQueue_.size() > 0){
-                notEmpty_.notify_all();
+            runTask(task);
+            runSlot();
+            if(buffered_ > 0){
+                maybeFlush();
+            }
+
+            idleThreadSize_++;
+            lastTime = std::chrono::high_resolution_clock().now();
+            continue;
+        }
+        if(taskSize_ > 0){
+            // 提交的线程占了名额，还没放进队列
+            std::this_thread::yield();
+            continue;
+        }
+        if(!isPoolRunning_){
+            std::unique_lock<std::mutex> lock(mtx_);
+            exitThread(threadId);
+            return;
+        }
+        if(buffered_ > 0){
+            auto wait = flushExpired();
+            if(wait.count() > 0){
+                std::unique_lock<std::mutex> lock(mtx_);
+                sleepers_++;
+                if(taskSize_ == 0){
+                    notEmpty_.wait_for(lock, wait);
+                }
+                sleepers_--;
+            }
+            continue;
+        }
+        if(slotted_ > 0){
+            std::unique_lock<std::mutex> lock(mtx_);
+            if(stealSlot(task)){
+                lock.unlock();
+                idleThreadSize_--;
+                runTask(task);
+                runSlot();
+                idleThreadSize_++;
+                lastTime = std::chrono::high_resolution_clock().now();
+                continue;
             }
+            sleepers_++;
+            if(taskSize_ == 0){
+                notEmpty_.wait_for(lock, std::chrono::microseconds(LIFO_STEAL_DELAY));
+            }
+            sleepers_--;
+            continue;
+        }
+        if(idle_.strategy() != IdleStrategy::IDLE_PARK && spinWait()){
+            continue;
+        }
 
-            //取出任务，任务队列不满，可以继续生产任务
-            notFull_.notify_all();
+        // 先登记 sleepers_ 再检查 taskSize_ 和 buffered_，和提交时 先加计数再看 sleepers_ 对应，不会漏掉唤醒
+        std::unique_lock<std::mutex> lock(mtx_);
+        sleepers_++;
+        bool timeout = false;
+        if(taskSize_ == 0 && buffered_ == 0 && slotted_ == 0 && isPoolRunning_){
+            if(poolMode_.isCached()){
+                timeout = std::cv_status::timeout == notEmpty_.wait_for(lock, std::chrono::seconds(1));
+            }
+            else {
+                notEmpty_.wait(lock);
+            }
+        }
+        sleepers_--;
+        if(timeout && retireIdle(threadId, lastTime)){
+            return;
+        }
+    }
+  }
 
-            //把锁释放掉
+  // 把用户函数包装成任务，result 得到对应的 future
+  template <typename Rtype, typename Fun, typename ... Args>
+  Task makeTask(TaskFuture<Rtype>& result, const std::shared_ptr<Completion>& done, Fun&& func, Args&& ...args)
+  {
+    if constexpr (std::is_copy_constructible_v<Task>){
+        // std::function 要求可拷贝，packaged_task 只能移动，只好放在 shared_ptr 里
+        auto task = std::make_shared<std::packaged_task<Rtype()>>(
+            std::bind(std::forward<Fun>(func), std::forward<Args>(args)...));
+        result = TaskFuture<Rtype>(task->get_future(), done);
+        return [task, done](){ (*task)(); done->complete(); };
+    }
+    else {
+        std::packaged_task<Rtype()> task(std::bind(std::forward<Fun>(func), std::forward<Args>(args)...));
+        result = TaskFuture<Rtype>(task.get_future(), done);
+        return [task = std::move(task), done]() mutable { task(); done->complete(); };
+    }
+  }
+
+  // 每个工作线程一个槽，只有自己能放任务，自己和空闲线程都能取。
+  // 状态 SLOT_BUSY 表示有线程正在读写 task，其他线程要等它结束
+  struct WorkerSlot
+  {
+    static constexpr int SLOT_EMPTY = 0;
+    static constexpr int SLOT_FULL = 1;
+    static constexpr int SLOT_BUSY = 2;
+
+    std::atomic_int state{SLOT_EMPTY};
+    std::atomic<long long> pushTime{0};  // 放进来的时间，决定别的线程什么时候可以偷
+    Task task;
+  };
+
+  // 工作线程把任务放进自己的槽，返回true表示槽里原来有任务，被换到 displaced
+  bool slotPut(WorkerSlot& slot, Task&& task, Task& displaced)
+  {
+    long long now = std::chrono::steady_clock::now().time_since_epoch().count();
+    for(;;)
+    {
+        int state = slot.state.load(std::memory_order_acquire);
+        if(state == WorkerSlot::SLOT_EMPTY){
+            // 只有所属的线程会从空变满，不用CAS
+            slot.task = std::move(task);
+            slot.pushTime = now;
+            slot.state.store(WorkerSlot::SLOT_FULL, std::memory_order_release);
+            return false;
+        }
+        if(state == WorkerSlot::SLOT_FULL
+          && slot.state.compare_exchange_weak(state, WorkerSlot::SLOT_BUSY, std::memory_order_acquire)){
+            displaced = std::move(slot.task);
+            slot.task = std::move(task);
+            slot.pushTime = now;
+            slot.state.store(WorkerSlot::SLOT_FULL, std::memory_order_release);
+            return true;
         }
+        cpuRelax();  // 别的线程正在偷
+    }
+  }
+
+  // 从槽里取任务，steal 为 true 时只取放进去超过 LIFO_STEAL_DELAY 的任务
+  bool slotTake(WorkerSlot& slot, Task& task, bool steal)
+  {
+    int state = slot.state.load(std::memory_order_acquire);
+    if(state != WorkerSlot::SLOT_FULL){
+        return false;
+    }
+    if(steal){
+        long long now = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto delay = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::microseconds(LIFO_STEAL_DELAY)).count();
+        if(now - slot.pushTime < delay){
+            return false;
+        }
+    }
+    if(!slot.state.compare_exchange_strong(state, WorkerSlot::SLOT_BUSY, std::memory_order_acquire)){
+        return false;
+    }
+    task = std::move(slot.task);
+    slot.task = Task();
+    slot.state.store(WorkerSlot::SLOT_EMPTY, std::memory_order_release);
+    slotted_--;
+    return true;
+  }
+
+  // 执行完一个任务后，接着执行自己槽里的任务
+  void runSlot()
+  {
+    Task task;
+    for(int streak = 0; slotTake(*workerSlot_, task, false); streak++)
+    {
+        if(streak == LIFO_MAX_STREAK){
+            // 连续执行太多了，移到公共队列末尾，先执行别的任务；队列满了只好接着执行
+            if(enqueue(&task, 1, false)){
+                return;
+            }
+        }
+        runTask(task);
+        task = Task();
+        if(streak == LIFO_MAX_STREAK){
+            return;
+        }
+    }
+  }
+
+  // 空闲线程偷别的工作线程槽里等了太久的任务，调用时持有 mtx_
+  bool stealSlot(Task& task)
+  {
+    for(auto& item : slots_){
+        if(item.second.get() != workerSlot_ && slotTake(*item.second, task, true)){
+            return true;
+        }
+    }
+    return false;
+  }
 
-        //线程执行任务    function<void()>
-        if(task != nullptr){
+  //线程执行任务
+  //兜底：保证线程不会因为异常退出，线程计数也不会错
+  void runTask(Task& task)
+  {
+    if(task){
+        // NoStats 时 record 是常量 nullptr，下面两处记录连同线程局部变量的读取都被编译器去掉
+        WorkerRecord* record = StatsPolicy::TRACK_WORKERS ? workerRecord_ : nullptr;
+        WorkerRecord::Snapshot prev;
+        if(record != nullptr){
+            prev = record->begin();
+        }
+        try {
             task();
         }
+        catch(...) {
+            stats_.onUnhandled();
+            if(errorHandler_){
+                errorHandler_(std::current_exception());
+            }
+            else {
+                std::cerr << "threadId: " << std::this_thread::get_id() << " task throw unhandled exception" << std::endl;
+            }
+        }
+        if(record != nullptr){
+            record->end(prev);
+        }
+        stats_.onExecute();
+    }
+  }
 
-        idleThreadSize_++;
+  // 看门狗线程：定期采样每个工作线程的记录，同一个任务只报告一次
+  void watchdogFunc()
+  {
+    std::vector<std::uint64_t> reported(recordCount_, 0);
+    std::unique_lock<std::mutex> lock(watchdogMtx_);
+    while(!watchdogCond_.wait_for(lock, watchdogInterval_, [&]()->bool { return watchdogStop_; }))
+    {
+        long long now = std::chrono::steady_clock::now().time_since_epoch().count();
+        for(std::size_t i = 0; i < recordCount_; i++)
+        {
+            if(!records_[i].inUse()){
+                continue;
+            }
+            WorkerRecord::Snapshot s = records_[i].snapshot();
+            if(s.start == 0 || s.executed == reported[i]){
+                continue;
+            }
+            auto runningFor = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::duration(now - s.start));
+            if(runningFor < watchdogThreshold_){
+                continue;
+            }
+            reported[i] = s.executed;
+            StuckTask stuck{s.threadId, s.name, runningFor};
+            if(onStuck_){
+                onStuck_(stuck);
+            }
+            else {
+                std::cerr << "watchdog: threadId: " << stuck.threadId << " task "
+                          << (!stuck.name.empty() ? stuck.name : "<unnamed>")
+                          << " running for " << stuck.runningFor.count() << "ms" << std::endl;
+            }
+        }
+    }
+  }
+
+  static void jsonEscape(std::ostream& out, const char* str)
+  {
+    for(; *str != '\0'; str++)
+    {
+        unsigned char c = static_cast<unsigned char>(*str);
+        if(c == '"' || c == '\\'){
+            out << '\\' << c;
+        }
+        else if(c < 0x20){
+            const char* hex = "0123456789abcdef";
+            out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+        }
+        else {
+            out << c;
+        }
+    }
+  }
+
+  // 把 n 个任务一次放进任务队列，只拿一次锁（或者只做一次 CAS），队列满了等待1s，失败返回false
+  // wait 为 false 时不等待，失败时任务原样留在 tasks 里。
+  // 不记 stats_.onSubmit()：槽里的任务移到公共队列也走这里，由用户提交的入口自己记
+  bool enqueue(Task* tasks, std::size_t n, bool wait = true)
+  {
+    if constexpr (Queue::NEEDS_POOL_LOCK){
+        std::unique_lock<std::mutex> lock(mtx_);
+        //线程的通信  等待任务队列有空余
+        // 提交任务，最长阻塞时间不超过1s，否则任务提交失败，返回
+        auto hasRoom = [&]()->bool { return taskSize_ + n <= taskQueThreshHold_; };
+        if(wait ? !notFull_.wait_for(lock, std::chrono::seconds(1), hasRoom) : !hasRoom())
+        {
+            //等待了1s，任务提交失败
+            return false;
+        }
+
+        //如果有空余了，就将任务放入任务队列
+        for(std::size_t i = 0; i < n; i++){
+            taskQueue_.push(std::move(tasks[i]), currentWorker());
+        }
+        taskSize_ += n;
+        //因为新放了任务，任务队列肯定不空了，在notEmpty上进行通知
+        notEmpty_.notify_all();
 
-        auto lastTime = std::chrono::high_resolution_clock().now();
+        // cached模式下，根据空闲线程和任务数量的情况，判断是否需要新建线程
+        if(poolMode_.isCached()
+          && taskSize_ > idleThreadSize_
+          && curThreadSize_ < threadThreshHold_)
+          {
+            addThread();
+          }
+    }
+    else {
+        // 队列自己保证线程安全：先在 taskSize_ 上占名额，再放进队列，不拿线程池的锁
+        if(!reserveSlot(n, wait))
+        {
+            return false;
+        }
+        for(std::size_t i = 0; i < n; i++){
+            // 占到名额不代表环形队列的槽位已经空出来：取任务的线程可能抢到了位置还没来得及释放槽位，
+            // 这时 push 会失败，任务原样留着，等它释放就行，不能丢掉（丢掉的话占的名额永远还不回来）
+            while(!taskQueue_.push(std::move(tasks[i]), currentWorker())){
+                std::this_thread::yield();
+            }
+        }
+
+        // 只有工作线程睡眠了才需要拿锁通知
+        if(sleepers_ > 0){
+            std::unique_lock<std::mutex> lock(mtx_);
+            if(n == 1){
+                notEmpty_.notify_one();
+            }
+            else {
+                notEmpty_.notify_all();
+            }
+        }
 
+        if(poolMode_.isCached()
+          && taskSize_ > idleThreadSize_
+          && curThreadSize_ < threadThreshHold_)
+          {
+            std::unique_lock<std::mutex> lock(mtx_);
+            if(curThreadSize_ < threadThreshHold_){
+                addThread();
+            }
+          }
     }
+    return true;
+  }
 
+  // 生产者线程的提交缓冲，由线程池登记，到期了工作线程也可以替它发布
+  struct SubmitBuffer
+  {
+    const void* owner = nullptr;  // 所属的线程池
+    std::atomic_bool closed{false};  // 线程池已经析构
+    std::mutex mtx;  // 只有所属的生产者和偶尔来发布的工作线程会竞争
+    std::vector<Task> tasks;
+    std::vector<std::shared_ptr<Completion>> dones;
+    std::chrono::steady_clock::time_point first;  // 缓冲里最早一个任务的提交时间
+  };
+
+  // 当前线程在本线程池的缓冲，第一次提交时创建
+  SubmitBuffer& localBuffer()
+  {
+    for(auto it = localBuffers_.begin(); it != localBuffers_.end();){
+        if((*it)->closed){
+            it = localBuffers_.erase(it);
+            continue;
+        }
+        if((*it)->owner == this){
+            return **it;
+        }
+        ++it;
+    }
+    auto buffer = std::make_shared<SubmitBuffer>();
+    buffer->owner = this;
+    {
+        std::unique_lock<std::mutex> lock(buffersMtx_);
+        buffers_.push_back(buffer);
+    }
+    localBuffers_.push_back(buffer);
+    return *buffer;
+  }
+
+  void bufferTask(Task&& task, std::shared_ptr<Completion>&& done)
+  {
+    SubmitBuffer& buffer = localBuffer();
+    std::vector<Task> tasks;
+    std::vector<std::shared_ptr<Completion>> dones;
+    bool first = false;
+    {
+        std::unique_lock<std::mutex> lock(buffer.mtx);
+        auto now = std::chrono::steady_clock::now();
+        if(buffer.tasks.empty()){
+            buffer.first = now;
+            first = true;
+        }
+        buffer.tasks.emplace_back(std::move(task));
+        buffer.dones.emplace_back(std::move(done));
+        buffered_++;
+        if(buffer.tasks.size() >= batchSize_ || now - buffer.first >= maxDelay_){
+            takeBuffer(buffer, tasks, dones);
+        }
+    }
+    if(!tasks.empty()){
+        publish(tasks, dones);
+    }
+    else if(first && sleepers_ > 0){
+        // 工作线程都睡了，叫醒一个来负责到期发布
+        std::unique_lock<std::mutex> lock(mtx_);
+        notEmpty_.notify_one();
+    }
+  }
+
+  // 把缓冲里的任务移出来，调用时持有 buffer.mtx
+  void takeBuffer(SubmitBuffer& buffer, std::vector<Task>& tasks, std::vector<std::shared_ptr<Completion>>& dones)
+  {
+    buffered_ -= buffer.tasks.size();
+    for(auto& task : buffer.tasks){
+        tasks.emplace_back(std::move(task));
+    }
+    for(auto& done : buffer.dones){
+        dones.emplace_back(std::move(done));
+    }
+    buffer.tasks.clear();
+    buffer.dones.clear();
+  }
+
+  // 一批任务放进任务队列，每次最多放 taskQueThreshHold_ 个，一次放不下全部时也不会整批失败。
+  // untilDone 为 true 时（线程池析构）一直等到有空余；否则失败的任务直接销毁，
+  // future 得到 broken_promise，完成状态照常通知
+  void publish(std::vector<Task>& tasks, std::vector<std::shared_ptr<Completion>>& dones, bool untilDone = false)
+  {
+    std::size_t offset = 0;
+    while(offset < tasks.size())
+    {
+        std::size_t n = std::min<std::size_t>(tasks.size() - offset, taskQueThreshHold_);
+        if(enqueue(tasks.data() + offset, n)){
+            for(std::size_t i = 0; i < n; i++){
+                stats_.onSubmit();
+            }
+            offset += n;
+            continue;
+        }
+        if(untilDone){
+            continue;
+        }
+        std::cerr << "task queue is full. submit " << tasks.size() - offset << " buffered tasks fail." << std::endl;
+        for(std::size_t i = offset; i < tasks.size(); i++){
+            stats_.onReject();
+            tasks[i] = Task();
+            dones[i]->complete();
+        }
+        break;
+    }
+    tasks.clear();
+    dones.clear();
+  }
+
+  // 发布所有已经到期的缓冲，返回0表示发布了任务（或者队列已满），否则返回离最早一个缓冲到期还有多久
+  // 工作线程调用，不能等待队列有空余：放不下的任务留在缓冲里，下次再发布
+  std::chrono::nanoseconds flushExpired()
+  {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds wait = maxDelay_;
+    bool published = false;
+    std::unique_lock<std::mutex> lock(buffersMtx_);
+    for(auto it = buffers_.begin(); it != buffers_.end();){
+        SubmitBuffer& buffer = **it;
+        std::unique_lock<std::mutex> bufferLock(buffer.mtx, std::try_to_lock);
+        if(!bufferLock.owns_lock()){
+            ++it;  // 生产者正在用，它自己会检查是否到期
+            continue;
+        }
+        if(buffer.tasks.empty()){
+            if(it->use_count() == 1){
+                // 生产者线程已经退出
+                bufferLock.unlock();
+                it = buffers_.erase(it);
+                continue;
+            }
+        }
+        else if(now - buffer.first >= maxDelay_){
+            if(enqueue(buffer.tasks.data(), buffer.tasks.size(), false)){
+                for(std::size_t i = 0; i < buffer.tasks.size(); i++){
+                    stats_.onSubmit();
+                }
+                buffered_ -= buffer.tasks.size();
+                buffer.tasks.clear();
+                buffer.dones.clear();
+            }
+            published = true;
+        }
+        else {
+            wait = std::min<std::chrono::nanoseconds>(wait, maxDelay_ - (now - buffer.first));
+        }
+        ++it;
+    }
+    return published ? std::chrono::nanoseconds(0) : wait;
+  }
+
+  // 工作线程每执行完一个任务检查一次，同一时间段只有一个线程去扫描缓冲
+  void maybeFlush()
+  {
+    long long now = std::chrono::steady_clock::now().time_since_epoch().count();
+    long long next = nextScan_;
+    if(now < next){
+        return;
+    }
+    auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(maxDelay_).count() / 2;
+    if(nextScan_.compare_exchange_strong(next, now + step)){
+        flushExpired();
+    }
+  }
+
+  // 线程池析构时发布所有缓冲，一个缓冲一个缓冲地发布，队列满了就等，缓冲的任务都要执行
+  void flushAll()
+  {
+    std::vector<std::shared_ptr<SubmitBuffer>> buffers;
+    {
+        std::unique_lock<std::mutex> lock(buffersMtx_);
+        buffers.swap(buffers_);
+    }
+    for(auto& buffer : buffers)
+    {
+        std::vector<Task> tasks;
+        std::vector<std::shared_ptr<Completion>> dones;
+        {
+            std::unique_lock<std::mutex> bufferLock(buffer->mtx);
+            takeBuffer(*buffer, tasks, dones);
+            buffer->closed = true;
+        }
+        publish(tasks, dones, true);
+    }
+  }
+
+  // 任务队列满了，提交失败，返回一个默认值
+  template <typename Rtype>
+  TaskFuture<Rtype> rejectTask(const std::shared_ptr<Completion>& done)
+  {
+    std::cerr << "task queue is full. submit task fail." << std::endl;
+    stats_.onReject();
+    std::packaged_task<Rtype()> task([]() ->Rtype { return Rtype(); });
+    task();
+    done->complete();
+    return TaskFuture<Rtype>(task.get_future(), done);
+  }
+
+  // 不拿锁在 taskSize_ 上占 n 个名额，最长等待1s
+  bool reserveSlot(std::size_t n, bool wait)
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    for(;;)
+    {
+        unsigned size = taskSize_;
+        while(size + n <= taskQueThreshHold_){
+            if(taskSize_.compare_exchange_weak(size, size + n)){
+                return true;
+            }
+        }
+        if(!wait || std::chrono::steady_clock::now() >= deadline){
+            return false;
+        }
+        std::this_thread::yield();
+    }
+  }
+
+  // 创建新线程，调用时持有 mtx_
+  void addThread()
+  {
+    auto ptr = std::make_unique<Thread>(std::bind(&BasicThreadPool::threadFunc, this, std::placeholders::_1));
+    int threadId = ptr->getId();
+    threads_.emplace(threadId, std::move(ptr));
+    threads_[threadId]->start(); // 让新建的线程运行起来
+    curThreadSize_++;
+    idleThreadSize_++;
+  }
+
+  // 线程池结束，线程退出，调用时持有 mtx_
+  void exitThread(int threadId)
+  {
+    threads_.erase(threadId);
+    slots_.erase(threadId);
+    if(workerRecord_ != nullptr){
+        workerRecord_->release();
+    }
+    std::cout << "threadId: " << std::this_thread::get_id() << " exit!" << std::endl;
+    exitCond_.notify_all();
+  }
+
+  // cached模式下回收空闲太久的线程，调用时持有 mtx_，返回true表示线程已经回收
+  bool retireIdle(int threadId, std::chrono::high_resolution_clock::time_point lastTime)
+  {
+    auto now = std::chrono::high_resolution_clock().now(); //当前时间
+    auto dur = std::chrono::duration_cast<std::chrono::seconds>(now-lastTime);
+    if(dur.count() >= THREAD_MAX_IDLE_TIME
+       && curThreadSize_ > initThreadSize_){
+        //开始回收当前线程
+        //线程数量相关变量的修改
+        //将线程从列表中移除
+        //我们需要一个映射关系，threadFunc找到列表中的thread. threadId => thread对象 =>删除
+        threads_.erase(threadId);
+        slots_.erase(threadId);
+        if(workerRecord_ != nullptr){
+            workerRecord_->release();
+        }
+        curThreadSize_--;
+        idleThreadSize_--;
+
+        std::cout << "threadId: " << std::this_thread::get_id() << " exit!" << std::endl;
+        return true;
+    }
+    return false;
+  }
+
+  // 空闲自旋，返回true表示看到了任务（或者线程池要结束），返回false表示该去睡眠了
+  bool spinWait()
+  {
+    int spins = 0;
+    int backoff = 1;
+    for(;;)
+    {
+        if(taskSize_ > 0 || buffered_ > 0 || slotted_ > 0 || !isPoolRunning_){
+            return true;
+        }
+        if(idle_.strategy() == IdleStrategy::IDLE_BUSY_SPIN){
+            cpuRelax();
+        }
+        else if(spins < idle_.spinCount()){
+            for(int i = 0; i < backoff; i++){
+                cpuRelax();
+            }
+            if(idle_.strategy() == IdleStrategy::IDLE_SPIN_PARK && backoff < idle_.maxBackoff()){
+                backoff *= 2;
+            }
+            spins++;
+        }
+        else if(idle_.strategy() == IdleStrategy::IDLE_SPIN_YIELD){
+            std::this_thread::yield();
+        }
+        else {
+            return false;
+        }
+    }
+  }
+
+  // 当前线程是本线程池的工作线程时返回它的id，否则返回-1
+  int currentWorker() const
+  {
+    return workerPool_ == this ? workerId_ : -1;
   }
 
   bool checkRunningState()
@@ -233,57 +1415,82 @@ private:
   }
 
 private:
- // std::vector<std::unique_ptr<Thread>> threads_;  // 线程, 使用智能指针，这样内存会自动释放。裸指针的话，还需要我们手动释放
   std::unordered_map<int, std::unique_ptr<Thread>> threads_; // 线程列表
   std::size_t initThreadSize_;  // 线程的初始数量
   std::atomic_uint idleThreadSize_; //空闲线程的数量
   std::atomic_uint curThreadSize_; //记录当前线程池里线程的总数量
   std::size_t threadThreshHold_;  //线程数量的阈值
 
-
-// Task  =>  函数对象
-  using Task = std::function<void()>;
-  std::queue<Task> taskQueue_;
+  Queue taskQueue_;
   std::atomic_uint taskSize_;  // 任务数量
   std::size_t taskQueThreshHold_;  // 任务队列阈值
+  std::atomic_uint sleepers_;  // 睡在 notEmpty_ 上的线程数
+  std::size_t batchSize_;  // 批量提交的大小，1 表示不缓冲
+  std::chrono::microseconds maxDelay_;  // 任务在缓冲里最多停留的时间
+  std::vector<std::shared_ptr<SubmitBuffer>> buffers_;  // 所有生产者线程的缓冲
+  std::mutex buffersMtx_;
+  std::atomic_uint buffered_;  // 缓冲里还没发布的任务数
+  std::atomic<long long> nextScan_;  // 下一次允许扫描缓冲的时间
+  std::unordered_map<int, std::unique_ptr<WorkerSlot>> slots_;  // 每个工作线程的槽，由 mtx_ 保护
+  std::atomic_uint slotted_;  // 槽里的任务数
+  std::unique_ptr<WorkerRecord[]> records_;  // 每个工作线程在执行什么，start 时分配
+  std::size_t recordCount_;
+  std::thread watchdog_;  // 看门狗线程
+  std::chrono::milliseconds watchdogThreshold_;  // 任务执行超过多久算卡住，0 表示不开看门狗
+  std::chrono::milliseconds watchdogInterval_;  // 采样间隔
+  std::function<void(const StuckTask&)> onStuck_;
+  std::mutex watchdogMtx_;
+  std::condition_variable watchdogCond_;
+  bool watchdogStop_;
   std::mutex mtx_;
   std::condition_variable notFull_; // 表示任务队列不满
   std::condition_variable notEmpty_; // 表示任务队列不空
   std::condition_variable exitCond_; // 等待线程所有资源回收
 
-  PoolMode poolMode_;  //线程池类型
+  ModePolicy poolMode_;  //线程池类型
+  IdlePolicy idle_;  // 空闲等待策略
+  StatsPolicy stats_;  // 统计
+  std::function<void(std::exception_ptr)> errorHandler_; // 未处理异常的回调
 
   std::atomic_bool isPoolRunning_; // 线程池是否start
-};
-
-class Thread
-{
-public:
-  using ThreadFunc = std::function<void(int)>;
 
-  Thread(ThreadFunc func):func_(func), threadId_(generate_++){}
-  ~Thread();
-  void start()
-  {
-    std::thread t(func_, threadId_);
-    t.detach();
-  }
-  int getId() const
-  {
-    return threadId_; 
-  }
-private:
-  ThreadFunc func_;
-  static int generate_;
-  int threadId_; //保存线程id --- 不是真的线程id，是我们generate自增
+  inline static thread_local const void* workerPool_ = nullptr;  // 当前线程所属的线程池
+  inline static thread_local int workerId_ = -1;  // 当前线程在线程池里的id
+  inline static thread_local WorkerSlot* workerSlot_ = nullptr;  // 当前工作线程的槽
+  inline static thread_local WorkerRecord* workerRecord_ = nullptr;  // 当前工作线程的记录
+  inline static thread_local std::vector<std::shared_ptr<SubmitBuffer>> localBuffers_;  // 当前线程在各个线程池的缓冲
 };
 
-int Thread::generate_ = 0;
+// 原来的线程池：互斥锁队列，运行时设置模式和空闲策略
+using ThreadPool = BasicThreadPool<>;
 
-enum class PoolMode
+template <typename R>
+template <typename Pool, typename Fun>
+auto TaskFuture<R>::then(Pool& pool, Fun&& func) -> TaskFuture<decltype(func(std::declval<TaskFuture<R>>()))>
 {
-    MODE_FIXED,  // 数量固定
-    MODE_CACHED,  // 动态变化
-};
+    using Rtype = decltype(func(std::declval<TaskFuture<R>>()));
+    auto self = std::make_shared<TaskFuture<R>>(std::move(*this));
+    auto task = std::make_shared<std::packaged_task<Rtype()>>(
+        [self, func = std::forward<Fun>(func)]() mutable -> Rtype { return func(std::move(*self)); });
+    auto done = std::make_shared<Completion>();
+    TaskFuture<Rtype> result(task->get_future(), done);
+
+    std::shared_ptr<Completion> prev = self->completion();
+    // 在 complete() 里提交，可能是在工作线程上，不能等待队列有空余：
+    // 队列满了就直接执行续作，续作和它的完成状态都不能丢
+    auto submit = [&pool, task, done](){
+        auto next = [task, done](){ (*task)(); done->complete(); };
+        if(!pool.trySubmitTask(next)){
+            next();
+        }
+    };
+    if(prev){
+        prev->listen(submit);
+    }
+    else {
+        submit();  // 没有完成状态的future（比如默认构造的），直接提交
+    }
+    return result;
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,174 @@
+#ifndef WHEN_H
+#define WHEN_H
+
+#include "threadpool.h"
+#include <tuple>
+#include <iterator>
+
+/*
+whenAll / whenAny：把多个 submitTask 返回的 TaskFuture 聚合成一个 TaskFuture
+1. 用一个原子倒计数跟踪完成情况，全部完成（或第一个完成）时只唤醒一次等待者，
+   不用对 N 个 future 依次 get，每个都唤醒一次
+2. 返回的也是 TaskFuture，可以用 then 把汇总步骤作为线程池任务执行，而不是阻塞一个线程等待
+
+example:
+ThreadPool pool;
+pool.start(4);
+
+auto all = whenAll(pool.submitTask(sum1, 1, 2), pool.submitTask(sum2, 1, 2, 3));
+auto total = all.then(pool, [](auto done) {
+    auto futures = done.get();  // 这里所有任务都已完成，get 不会阻塞
+    return std::get<0>(futures).get() + std::get<1>(futures).get();
+});
+std::cout << total.get() << std::endl;
+
+std::vector<TaskFuture<int>> futures;
+...
+auto any = whenAny(futures.begin(), futures.end());
+WhenAnyResult<std::vector<TaskFuture<int>>> first = any.get();
+first.futures[first.index].get();
+
+注意：future 会被移动进聚合结果里，每个 future 只能聚合一次
+*/
+template <typename Sequence>
+struct WhenAnyResult
+{
+    std::size_t index;  // 第一个完成的 future 的下标
+    Sequence futures;
+};
+
+namespace detail
+{
+// 聚合状态：remaining 减到 0 的那一方负责设置结果。
+// 登记回调本身也占一个计数，保证登记完成之前不会把 future 移走
+template <typename Sequence, typename Value>
+struct WhenState
+{
+    WhenState(Sequence&& seq, std::size_t count)
+      : futures(std::move(seq)),
+        remaining(count + 1),
+        index(NONE),
+        done(std::make_shared<Completion>())
+    {}
+
+    // whenAll：每完成一个调用一次；whenAny：第一个完成的调用一次
+    void arrive()
+    {
+        if(remaining.fetch_sub(1) == 1){
+            finish();
+        }
+    }
+
+    // whenAny：只有第一个完成的 future 会抢到 index
+    void first(std::size_t i)
+    {
+        std::size_t expected = NONE;
+        if(index.compare_exchange_strong(expected, i)){
+            arrive();
+        }
+    }
+
+    void finish()
+    {
+        if constexpr (std::is_same_v<Value, Sequence>){
+            promise.set_value(std::move(futures));
+        }
+        else {
+            promise.set_value(Value{index, std::move(futures)});
+        }
+        done->complete();
+    }
+
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+    Sequence futures;
+    std::atomic<std::size_t> remaining;
+    std::atomic<std::size_t> index;
+    std::promise<Value> promise;
+    std::shared_ptr<Completion> done;
+};
+
+// 在每个 future 上登记回调，没有完成状态的 future 当作已经完成
+template <typename R, typename Fun>
+void listen(TaskFuture<R>& future, Fun&& func)
+{
+    std::shared_ptr<Completion> c = future.completion();
+    if(c){
+        c->listen(std::forward<Fun>(func));
+    }
+    else {
+        func();
+    }
+}
+
+template <typename Sequence, typename Value, typename ForEach>
+TaskFuture<Value> when(Sequence&& seq, std::size_t count, bool any, ForEach&& forEach)
+{
+    auto state = std::make_shared<WhenState<Sequence, Value>>(std::move(seq), any ? 1 : count);
+    TaskFuture<Value> result(state->promise.get_future(), state->done);
+
+    if(any && count == 0){
+        state->arrive();  // 没有 future 可等，直接完成，index 为 WhenState::NONE
+    }
+    forEach(state->futures, [&](auto& future, std::size_t i) {
+        if(any){
+            listen(future, [state, i](){ state->first(i); });
+        }
+        else {
+            listen(future, [state](){ state->arrive(); });
+        }
+    });
+    state->arrive();  // 登记完成
+    return result;
+}
+
+template <typename Tuple, typename Fun, std::size_t ... I>
+void forEachTuple(Tuple& tuple, Fun&& func, std::index_sequence<I...>)
+{
+    (func(std::get<I>(tuple), I), ...);
+}
+} // namespace detail
+
+template <typename ... Rs>
+TaskFuture<std::tuple<TaskFuture<Rs>...>> whenAll(TaskFuture<Rs>&& ...futures)
+{
+    using Sequence = std::tuple<TaskFuture<Rs>...>;
+    return detail::when<Sequence, Sequence>(
+        Sequence(std::move(futures)...), sizeof...(Rs), false,
+        [](Sequence& seq, auto&& func) { detail::forEachTuple(seq, func, std::index_sequence_for<Rs...>{}); });
+}
+
+template <typename Iterator>
+auto whenAll(Iterator first, Iterator last)
+    -> TaskFuture<std::vector<typename std::iterator_traits<Iterator>::value_type>>
+{
+    using Sequence = std::vector<typename std::iterator_traits<Iterator>::value_type>;
+    Sequence seq(std::make_move_iterator(first), std::make_move_iterator(last));
+    std::size_t count = seq.size();
+    return detail::when<Sequence, Sequence>(
+        std::move(seq), count, false,
+        [](Sequence& s, auto&& func) { for(std::size_t i = 0; i < s.size(); i++) func(s[i], i); });
+}
+
+template <typename ... Rs>
+TaskFuture<WhenAnyResult<std::tuple<TaskFuture<Rs>...>>> whenAny(TaskFuture<Rs>&& ...futures)
+{
+    using Sequence = std::tuple<TaskFuture<Rs>...>;
+    return detail::when<Sequence, WhenAnyResult<Sequence>>(
+        Sequence(std::move(futures)...), sizeof...(Rs), true,
+        [](Sequence& seq, auto&& func) { detail::forEachTuple(seq, func, std::index_sequence_for<Rs...>{}); });
+}
+
+template <typename Iterator>
+auto whenAny(Iterator first, Iterator last)
+    -> TaskFuture<WhenAnyResult<std::vector<typename std::iterator_traits<Iterator>::value_type>>>
+{
+    using Sequence = std::vector<typename std::iterator_traits<Iterator>::value_type>;
+    Sequence seq(std::make_move_iterator(first), std::make_move_iterator(last));
+    std::size_t count = seq.size();
+    return detail::when<Sequence, WhenAnyResult<Sequence>>(
+        std::move(seq), count, true,
+        [](Sequence& s, auto&& func) { for(std::size_t i = 0; i < s.size(); i++) func(s[i], i); });
+}
+
+#endif
@@ -35,7 +35,7 @@ ThreadPool::~ThreadPool()
     std::unique_lock<std::mutex> lock(mtx_);
 
     notEmpty_.notify_all();
-    exitCond_.wait(lock, [&]()->bool { threads_.size() == 0; }); // 等待线程对象全部被回收
+    exitCond_.wait(lock, [&]()->bool { return threads_.size() == 0; }); // 等待线程对象全部被回收
 
 }
 
@@ -54,12 +54,18 @@ void ThreadPool::setTaskQueThreshHold(int threshHold)  //设置任务队列阈
 }
 void ThreadPool::setThreadThreshHold(int threshHold)  //设置线程阈值,只有在cached模式下才能设置
 {
-    if(checkRunningState) return;
+    if(checkRunningState()) return;
     if(poolMode_ == PoolMode::MODE_CACHED){
         threadThreshHold_ = threshHold;
     }
 }
 
+void ThreadPool::setErrorHandler(std::function<void(std::exception_ptr)> handler)
+{
+    if(checkRunningState()) return;
+    errorHandler_ = handler;
+}
+
 Result ThreadPool::submitTask(std::shared_ptr<Task> sp)  // 提交任务
 {
     //获取锁
@@ -173,7 +179,7 @@ void ThreadPool::threadFunc(int threadId)
             idleThreadSize_--;
 
             //任务队列不空，取一个任务出来
-            auto task = taskQueue_.front();
+            task = taskQueue_.front();
             taskQueue_.pop();
             taskSize_--;
 
@@ -189,13 +195,24 @@ void ThreadPool::threadFunc(int threadId)
         }
 
         //线程执行任务
+        //任务的异常在exec里交给Result，这里只兜底，保证线程不会因为异常退出，线程计数也不会错
         if(task != nullptr){
-            task->exec();
+            try {
+                task->exec();
+            }
+            catch(...) {
+                if(errorHandler_){
+                    errorHandler_(std::current_exception());
+                }
+                else {
+                    std::cerr << "threadId: " << std::this_thread::get_id() << " task throw unhandled exception" << std::endl;
+                }
+            }
         }
 
         idleThreadSize_++;
 
-        auto lastTime = std::chrono::high_resolution_clock().now();
+        lastTime = std::chrono::high_resolution_clock().now();
 
     }
 
@@ -219,15 +236,15 @@ void ThreadPool::start(int initThreadSize) // 开启线程池
     curThreadSize_ = initThreadSize_;
     for(int i = 0;i < initThreadSize_;i++){
         //创建线程对象，把线程函数给到线程对象
-        auto ptr = std::make_unique<Thread>(std::bind(&threadFunc, this, std::placeholders::_1));
+        auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
         //threads_.emplace_back(std::move(ptr));
         int threadId = ptr->getId();
         threads_.emplace(threadId, std::move(ptr));
     }
-    for(int i = 0;i < initThreadSize_;i++){
+    for(auto& item : threads_){
         // 启动每一个线程
         //threads_[i]->start();
-        threads_[i]->start();
+        item.second->start();
         idleThreadSize_++; // 记录空闲线程的数量
     }
 }
@@ -258,7 +275,13 @@ Task::Task():result_(nullptr){}
 void Task::exec()
 {
     if(result_ != nullptr){
-        result_->setValue(run());
+        // 异常保存到Result里，在用户调用get时重新抛出
+        try {
+            result_->setValue(run());
+        }
+        catch(...) {
+            result_->setException(std::current_exception());
+        }
     }
 }
 
@@ -270,22 +293,114 @@ void Task::setResult(Result* res)
 //////////// Result方法的实现
 Result::Result(std::shared_ptr<Task> task, bool isValid)
               :isValid_(isValid),
-               task_(task)
+               task_(task),
+               isDone_(false)
                {
                 task_->setResult(this);
                }
 
 
 Any Result::get(){
-    if(isValid_){
+    if(!isValid_){
         return "";
     }
     sem_.wait();  // 阻塞，等待线程执行完成
+    if(exception_){
+        std::rethrow_exception(exception_);
+    }
     return std::move(any_);
 }
 
 void Result::setValue(Any any)  // 谁掉用的？
 {
     any_ = std::move(any);
+    notifyComplete();
+}
+
+void Result::setException(std::exception_ptr e)
+{
+    exception_ = e;
+    notifyComplete();
+}
+
+void Result::onComplete(std::function<void()> cb)
+{
+    {
+        std::unique_lock<std::mutex> lock(listenMtx_);
+        // 任务没有提交成功的话，不会再完成了
+        if(isValid_ && !isDone_){
+            listeners_.emplace_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+}
+
+void Result::notifyComplete()
+{
+    // 先把回调取出来再post：post之后用户线程可能马上析构Result
+    std::vector<std::function<void()>> listeners;
+    {
+        std::unique_lock<std::mutex> lock(listenMtx_);
+        isDone_ = true;
+        listeners.swap(listeners_);
+    }
     sem_.post();
+    for(auto& cb : listeners){
+        cb();
+    }
+}
+
+//////////// when_all / when_any 的实现
+WhenState::WhenState(int count)
+              :remaining_(count),
+               index_(-1)
+               {
+                if(count == 0){
+                    sem_.post();
+                }
+               }
+
+void WhenState::wait()
+{
+    sem_.wait();
+    sem_.post();  // 把资源还回去，其他等待者和下一次wait也能通过
+}
+
+int WhenState::index() const
+{
+    return index_;
+}
+
+void WhenState::arrive(int index)
+{
+    int expected = -1;
+    index_.compare_exchange_strong(expected, index);  // 只记录第一个完成的
+    if(remaining_.fetch_sub(1) == 1){
+        sem_.post();
+    }
+}
+
+std::shared_ptr<WhenState> whenAll(const std::vector<Result*>& results)
+{
+    auto state = std::make_shared<WhenState>(static_cast<int>(results.size()));
+    for(std::size_t i = 0; i < results.size(); i++){
+        int index = static_cast<int>(i);
+        results[i]->onComplete([state, index](){ state->arrive(index); });
+    }
+    return state;
+}
+
+std::shared_ptr<WhenState> whenAny(const std::vector<Result*>& results)
+{
+    auto state = std::make_shared<WhenState>(results.empty() ? 0 : 1);
+    for(std::size_t i = 0; i < results.size(); i++){
+        int index = static_cast<int>(i);
+        results[i]->onComplete([state, index](){
+            if(state->index() == -1){
+                state->arrive(index);
+            }
+        });
+    }
+    return state;
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <functional>
 #include <unordered_map>
 #include <thread>
+#include <exception>
 
 ///////////////
 class Any
@@ -47,10 +48,9 @@ public:
 // 派生类类型
   template <typename T>
   class Derive : public Base{
-    private:
-      T data_;
     public:
       Derive(T data):data_(data){}
+      T data_;
   };
 private:
 
@@ -93,6 +93,8 @@ private:
 };
 
 
+class Task;
+
 ////////////
 // 实现 接收提交到Task队列中的任务执行完后的返回结果
 class Result
@@ -105,16 +107,90 @@ public:
   // setValue方法，获取任务执行完的返回值
   void setValue(Any any);
 
-  // get方法，用户调用这个方法获得task的返回值
+  // setException方法，任务抛出异常时，把异常保存下来
+  void setException(std::exception_ptr e);
+
+  // get方法，用户调用这个方法获得task的返回值，任务抛出的异常会在这里重新抛出
   Any get();
 
+  // 登记一个完成回调，在执行任务的线程里调用；任务已经完成（或提交失败）的话立即调用
+  void onComplete(std::function<void()> cb);
+
 private:
+  void notifyComplete();
+
   Any any_; // 存储任务的返回值
+  std::exception_ptr exception_; // 存储任务抛出的异常
   Semaphore sem_; // 用于线程间通信
   std::shared_ptr<Task> task_;  // 指向对应的任务对象
   std::atomic_bool isValid_;  // 返回值是否有效
+  std::mutex listenMtx_; // 保护下面两个成员
+  bool isDone_; // 任务是否已完成
+  std::vector<std::function<void()>> listeners_; // 完成回调
+};
+
+//////////////
+// whenAll / whenAny 的聚合状态：一个原子倒计数，计数归零时只唤醒一次等待者，
+// 不用对N个Result依次get，每个都唤醒一次
+class WhenState
+{
+public:
+  WhenState(int count);
+
+  // 阻塞等待，可以多次调用
+  void wait();
+  // whenAny：第一个完成的Result的下标，没有Result时为-1
+  int index() const;
+
+  // 某个Result完成时调用
+  void arrive(int index);
+
+private:
+  std::atomic_int remaining_; // 还需要等待的数量
+  std::atomic_int index_;
+  Semaphore sem_;
 };
 
+// 等待所有Result完成，Result必须在聚合完成前保持有效
+std::shared_ptr<WhenState> whenAll(const std::vector<Result*>& results);
+// 等待任意一个Result完成
+std::shared_ptr<WhenState> whenAny(const std::vector<Result*>& results);
+
+
+enum class PoolMode
+{
+    MODE_FIXED,  // 数量固定
+    MODE_CACHED,  // 动态变化
+};
+
+class Thread
+{
+public:
+  using ThreadFunc = std::function<void(int)>;
+
+  Thread(ThreadFunc func);
+  ~Thread();
+  void start();
+  int getId() const;
+private:
+  ThreadFunc func_;
+  static int generate_;
+  int threadId_; //保存线程id --- 不是真的线程id，是我们generate自增
+};
+
+class Task
+{
+public:
+  Task();
+  ~Task() = default;
+
+  virtual Any run() = 0;
+  void exec();
+  void setResult(Result* res);
+
+private:
+  Result* result_;  // 不能用智能指针，要不然会和Result里的shared_ptr形成循环引用
+};
 
 /*
 example:
@@ -140,6 +216,8 @@ public:
   void setMode(PoolMode mode);
   void setTaskQueThreshHold(int threshHold);  //设置任务队列阈值
   void setThreadThreshHold(int threshHold); //设置线程阈值
+  // 设置错误处理函数，任务里没有被Result接住的异常交给它处理，工作线程不会因此退出
+  void setErrorHandler(std::function<void(std::exception_ptr)> handler);
   Result submitTask(std::shared_ptr<Task> sp);  // 提交任务
   // 线程初始的默认值为当前cpu的核心数量
   void start(int initThreadSize = std::thread::hardware_concurrency()); // 开启线程池
@@ -167,43 +245,9 @@ private:
   std::condition_variable exitCond_; // 等待线程所有资源回收
 
   PoolMode poolMode_;  //线程池类型
+  std::function<void(std::exception_ptr)> errorHandler_; // 未处理异常的回调
 
   std::atomic_bool isPoolRunning_; // 线程池是否start
 };
 
-class Thread
-{
-public:
-  using ThreadFunc = std::function<void(int)>;
-
-  Thread(ThreadFunc func);
-  ~Thread();
-  void start();
-  int getId() const;
-private:
-  ThreadFunc func_;
-  static int generate_;
-  int threadId_; //保存线程id --- 不是真的线程id，是我们generate自增
-};
-
-enum class PoolMode
-{
-    MODE_FIXED,  // 数量固定
-    MODE_CACHED,  // 动态变化
-};
-
-class Task
-{
-public:
-  Task();
-  ~Task() = default;
-
-  virtual Any run() = 0;
-  void exec();
-  void setResult(Result* res);
-
-private:
-  Result* result_;  // 不能用智能指针，要不然会和Result里的shared_ptr形成循环引用
-};
-
 #endif
\ No newline at end of file